@@ -0,0 +1,40 @@
+#!/bin/sh
+# Runs the collatz circle in benchmark mode (-b: starting values 1 to N, no sleeps, no per-term output) with process and
+# thread members over every transport they support, across circle sizes and windows, and prints one csv row per run.
+#
+# usage: ./bench.sh > results.csv
+# environment overrides: SEQUENCES (starting values per run), CHILDREN (members of the circle), WINDOWS,
+# TRANSPORTS, MAX_PROCESSES (bigger circles only run as threads)
+
+SEQUENCES=${SEQUENCES:-10000}
+CHILDREN=${CHILDREN:-"2 8 64 1024 4096"}
+WINDOWS=${WINDOWS:-"1 16 128"}
+TRANSPORTS=${TRANSPORTS:-"pipe futex eventfd"}
+MAX_PROCESSES=${MAX_PROCESSES:-64}
+
+dir=$(cd "$(dirname "$0")" && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+
+${CC:-gcc} -O2 -pthread -o "$bin/collatz_circle" "$dir/collatz_circle.c" || exit 1
+
+echo "members,transport,children,window,sequences,terms,seconds,terms_per_sec,hop_latency_ns"
+for children in $CHILDREN; do
+  for window in $WINDOWS; do
+    for transport in $TRANSPORTS; do
+      for members in process thread; do
+        if [ "$members" = thread ] && [ "$transport" = pipe ]; then
+          continue # thread members only talk over shared memory rings
+        fi
+        if [ "$members" = process ] && [ "$children" -gt "$MAX_PROCESSES" ]; then
+          continue
+        fi
+        "$bin/collatz_circle" -e "$members" -t "$transport" -w "$window" -b "$SEQUENCES" "$children" |
+          awk -v members="$members" -v transport="$transport" -v children="$children" -v window="$window" '
+            /^Members:/ { sequences = $8; terms = $10 }
+            /^Elapsed:/ { printf "%s,%s,%s,%s,%s,%s,%s,%s,%s\n", members, transport, children, window, sequences, terms, $2, $5, $9 }' ||
+          exit 1
+      done
+    done
+  done
+done
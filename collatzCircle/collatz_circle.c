@@ -1,14 +1,164 @@
+#define _GNU_SOURCE // F_SETPIPE_SZ
 #include <stdio.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #define READ 0
 #define WRITE 1
 
+// what travels around the circle, the sequence id lets many sequences share it at once
+// terms travel as 64 bits, a sequence that outgrows them switches to 128 bits for the rest of its trajectory
+typedef struct {
+  int sequence_id;
+  int steps; // terms computed so far, the stopping time once value reaches 1
+  uint64_t value; // current term (0 stops the circle), the low half of it once the sequence has gone wide
+  uint64_t high; // high half of a term that no longer fits in 64 bits (0 keeps the message on the fast path)
+  uint64_t sent_ns; // when the previous member of the circle sent it (only with stats, and last so pipes can leave it out)
+} collatz_message;
+
+// what the child that receives the 1 sends back to the parent when streaming
+typedef struct {
+  int sequence_id;
+  int steps; // STEPS_OVERFLOWED if a term outgrew 128 bits
+} sequence_result;
+
+#define STEPS_OVERFLOWED -1
+
+// most sequences in flight at once, small enough that no pipe in the circle (nor the shared completion pipe)
+// can ever fill up, which would leave every child blocked on a write (-p raises it for the pipe transport)
+#define MAX_WINDOW (PIPE_BUF / message_bytes)
+// largest batch that stays atomic on a pipe with more than one writer (pipe 0 and the completion pipe)
+#define ATOMIC_MESSAGES (PIPE_BUF / message_bytes)
+#define ATOMIC_RESULTS (PIPE_BUF / sizeof(sequence_result))
+// slots in each shared memory ring, more than a full window plus the stop message so a ring never fills
+#define RING_SLOTS 512
+// times a reader polls its shared memory rings before it goes to sleep
+#define SPIN_LIMIT 1000
+
+// sweep mode: stopping times are remembered for starting values below this (2 bytes each)
+#define MEMO_ENTRIES (1ull << 25)
+// starting values a sweep worker takes from its range at a time
+#define SWEEP_CHUNK 4096
+// the stopping time distribution is reported in buckets this many steps wide
+#define HISTOGRAM_WIDTH 50
+#define HISTOGRAM_BUCKETS 40
+
+// one sweep worker's share of the range plus what it found, shared so idle workers can steal from it
+typedef struct {
+  _Alignas(64) atomic_flag lock; // guards next and end
+  uint64_t next, end; // the owner takes chunks from next, thieves take the upper half down from end
+  uint64_t swept; // starting values this worker finished
+  int steals; // times it took work from another worker
+  int longest_steps;
+  uint64_t longest_start;
+  unsigned __int128 highest_odd; // the highest term is 3 times the highest odd term plus one
+  uint64_t highest_start;
+  int overflowed;
+  uint64_t histogram[HISTOGRAM_BUCKETS]; // starting values by stopping time
+} sweep_worker;
+
+// how a sweep worker steps its trajectories, the best one the cpu supports unless -k says otherwise
+typedef enum {
+  KERNEL_SCALAR,
+  KERNEL_AVX2,
+  KERNEL_AVX512,
+  KERNEL_BEST
+} sweep_kernel;
+
+// how messages travel between neighbours in the circle
+typedef enum {
+  TRANSPORT_PIPE,   // a kernel pipe per link (a syscall and a copy on each side of every hop)
+  TRANSPORT_FUTEX,  // shared memory ring per link, a reader with nothing to read sleeps on a futex
+  TRANSPORT_EVENTFD // shared memory ring per link, a reader with nothing to read sleeps in read() on an eventfd
+} transport_kind;
+
+// what the members of the circle are
+typedef enum {
+  MEMBER_PROCESS, // fork()ed children, each hop crosses into another address space
+  MEMBER_THREAD   // threads of the parent, cheap enough to run thousands of them (shared memory transports only)
+} member_kind;
+
+// where a thread member leaves its ready message and its counts, in place of a child's report pipe
+typedef struct {
+  _Alignas(64) atomic_uint state; // futex word, REPORT_READY then REPORT_DONE
+  pid_t tid;
+  int cpu;
+  int even_numbers_received;
+  int odd_numbers_received;
+} member_report;
+
+#define REPORT_READY 1
+#define REPORT_DONE 2
+// stack of each thread member, the child loop needs little and thousands of the default 8MB add up
+#define MEMBER_STACK_SIZE (256 * 1024)
+
+// single-producer/single-consumer ring of messages between two neighbours (shared memory transports)
+typedef struct {
+  _Alignas(64) atomic_uint tail; // next slot the writer fills
+  _Alignas(64) atomic_uint head; // next slot the reader empties
+  _Alignas(64) collatz_message slots[RING_SLOTS];
+} message_ring;
+
+// what a child's writers ring when it may be asleep waiting for a message (shared memory transports)
+typedef struct {
+  _Alignas(64) atomic_uint wake_seq; // futex word, bumped on every wake
+  atomic_uint sleeping; // set while the child is (about to be) asleep, so writers only make the syscall then
+} doorbell;
+
+// live counters of one child, only that child writes them, the parent (-i) and -x read them while the circle runs
+typedef struct {
+  _Alignas(64) _Atomic int pid;
+  _Atomic uint64_t messages; // messages taken off the circle
+  _Atomic uint64_t bytes_received, bytes_sent;
+  _Atomic uint64_t started_ns, stopped_ns; // CLOCK_MONOTONIC, stopped_ns stays 0 until the child receives the stop message
+  _Atomic uint64_t blocked_ns; // time spent waiting for a message, the rest is computing and passing messages on
+  _Atomic uint64_t blocked_since; // nonzero while waiting right now
+  _Atomic uint32_t queue_depth, max_queue_depth; // messages already waiting after each receive
+  _Atomic uint64_t max_latency_ns; // longest a message took from being sent by the previous member to reaching us
+} child_stats;
+
+// the shared memory stats page, named with -m so other processes can open it
+typedef struct {
+  int num_children;
+  _Atomic int running; // cleared once every child has exited
+  child_stats children[];
+} stats_page;
+
+// how consecutive members of the circle (or sweep workers) are spread over the cpus they may use (-a)
+typedef enum {
+  PLACE_LIST,  // in the order the cpus were given (-c), or by number
+  PLACE_SMT,   // neighbours on hyperthreads of the same core first
+  PLACE_CACHE  // neighbours on cores sharing a last level cache first
+} placement_kind;
+
+// a cpu and where it sits, for sorting
+typedef struct {
+  int cpu;
+  int package; // socket
+  int cache; // id of its L3 (-1 if there is none)
+  int core;
+} cpu_place;
+
 // struct for holding information specific to a given process
 typedef struct {
   bool is_child_process;
@@ -16,65 +166,313 @@ typedef struct {
   int collatz_fd_read;
   int collatz_fd_write;
   int report_to_parent_fd_write;
+  int sequence_done_fd_write; // streaming: tells the parent a sequence reached 1
+  int ring_read;   // shared memory transports: ring this child reads (-1 in the parent)
+  int ring_inject; // ring the parent injects starting values into, also read by child 0 (-1 in other children)
+  int ring_write;  // ring this process writes
+  // messages and completions wait here until the process is about to block, then go out in one write
+  // (the pipe transport reads a whole batch at once as well, so each hop costs a fraction of a syscall)
+  int batch_capacity; // messages each batch holds
+  char *send_batch; // packed messages of message_bytes each
+  int send_count;
+  sequence_result *done_batch;
+  int done_count;
+  char *receive_buffer; // bytes read but not yet handed out, may end in part of a message
+  size_t receive_start, receive_end;
+  child_stats *stats; // this child's counters (NULL in the parent and without stats)
+  member_report *report; // thread members report here instead of on a pipe (NULL for processes)
+  int cpu; // cpu this member is pinned to, -1 if it isn't
 } process_specific_information;
 
 // function declarations
 int** create_pipe_array(int num_child_processes);
-process_specific_information* collatz_circle_create(int num_child_processes, int **collatz_circle_pipe_array, int **report_to_parent_pipe_array);
+process_specific_information* collatz_circle_create(int num_child_processes, int **collatz_circle_pipe_array, int **report_to_parent_pipe_array, int window);
 void collatz_circle_loop(process_specific_information *ps_info);
-int collatz_next_term(int previous_term);
+bool collatz_next_term(uint64_t previous_term, uint64_t *next_term);
+bool collatz_next_term_wide(unsigned __int128 previous_term, unsigned __int128 *next_term);
+bool collatz_advance(collatz_message *message);
+char* collatz_term_string(const collatz_message *message, char *buffer);
 void collatz_perform_cleanup(int num_child_processes, process_specific_information *ps_info, int **collatz_circle_pipe_array, int **report_to_parent_pipe_array);
+void free_pipe_array(int **pipe_array, int num_child_processes);
+uint64_t* read_start_values(const char *path, int *count);
+void collatz_circle_stream(process_specific_information *ps_info, const uint64_t *start_values, int num_start_values, int window);
+void collatz_circle_shutdown(int num_child_processes, process_specific_information *ps_info, int **report_to_parent_pipe_array);
+int create_shared_rings(int num_child_processes);
+static inline message_ring* ring_of(int index);
+static inline doorbell* doorbell_of(int index);
+int collatz_sweep(uint64_t last, int num_workers);
+void circle_send(process_specific_information *ps_info, const collatz_message *message);
+void circle_receive(process_specific_information *ps_info, collatz_message *message);
+void circle_flush(process_specific_information *ps_info);
+void report_sequence_done(process_specific_information *ps_info, const sequence_result *result);
+int create_stats_page(int num_child_processes);
+void unlink_stats_page();
+static uint64_t now_ns();
+void print_stats(const stats_page *page);
+int watch_stats(const char *name);
+int parse_cpu_list(const char *list);
+int plan_placement();
+int place_child(int index);
+int start_member_threads(int num_members, int window);
+void report_ready(process_specific_information *ps_info, pid_t pid);
+void report_counts(process_specific_information *ps_info, pid_t pid, int even_numbers_received, int odd_numbers_received);
+pid_t await_ready(int index, int **report_to_parent_pipe_array, int *cpu);
+pid_t await_counts(int index, int **report_to_parent_pipe_array, int *even_numbers_received, int *odd_numbers_received);
 
+// streaming mode feeds these starting values into the circle without the demo sleeps or per-term output
+// and reports every stopping time plus throughput (none runs the interactive circle)
+uint64_t *start_values = NULL;
+int num_start_values = 0;
+bool benchmark = false; // -b: only report throughput
+int sequence_done_pipe[2]; // every child writes to it, only the parent reads (streaming)
+transport_kind transport = TRANSPORT_PIPE;
+void *rings; // ring i feeds child i, the extra last ring carries the parent's starting values to child 0
+size_t ring_stride; // bytes from one ring (and its doorbell) to the next, whole pages so no two children share one
+int *doorbell_fds; // one eventfd per child (eventfd transport)
+size_t shared_rings_size; // bytes mapped for rings and doorbells
+int spin_limit = SPIN_LIMIT;
+int pipe_size = 0; // -p: capacity requested for every pipe in the circle (0 keeps the kernel default)
+uint64_t sweep_last = 0; // -s: find every stopping time in [1, sweep_last] with the children as workers instead of a circle
+sweep_kernel kernel = KERNEL_BEST;
+// per-child counters, only kept (and only costing clock reads on every hop) with -m or -i
+stats_page *stats = NULL;
+// bytes of a message on a pipe, the timestamp only travels when there are stats to record it in
+size_t message_bytes = offsetof(collatz_message, sent_ns);
+size_t stats_size;
+char stats_name[NAME_MAX]; // -m: the stats page is the shm segment of this name (anonymous if empty)
+pid_t stats_owner = 0; // process that created the named segment and removes it
+int stats_interval_ms = 0; // -i: the parent prints the stats page this often while streaming
+// child i (or sweep worker i) runs on placement_cpus[i % num_placement_cpus], no pinning if there are none
+int *placement_cpus = NULL;
+int num_placement_cpus = 0;
+placement_kind placement = PLACE_LIST;
+bool pin_children = false; // -c or -a was given
+// -e thread runs the circle as threads of this process instead of fork()ed children
+member_kind members = MEMBER_PROCESS;
+process_specific_information *thread_members; // one per thread, each with its own batches
+member_report *member_reports;
+pthread_t *member_threads;
 
 int main(int argc, char *argv[]) {
-  if(argc < 2) { // ensure number of child processes was given
+  int opt;
+  int window = 0;
+  uint64_t range_start, range_end;
+  bool transport_given = false;
+  while((opt = getopt(argc, argv, "b:r:f:w:t:p:s:k:m:i:x:c:a:e:")) != -1) {
+    if(opt == 'b') {
+      // run starting values 1 to N, one at a time unless -w says otherwise
+      benchmark = true;
+      range_start = 1;
+      range_end = strtoull(optarg, NULL, 10) + 1;
+    }
+    else if(opt == 'r' && sscanf(optarg, "%" SCNu64 ":%" SCNu64, &range_start, &range_end) == 2) {
+      // run starting values [a,b)
+    }
+    else if(opt == 'f') {
+      start_values = read_start_values(optarg, &num_start_values);
+      if(start_values == NULL) {
+        return 1;
+      }
+      continue;
+    }
+    else if(opt == 'w') {
+      window = atoi(optarg);
+      continue;
+    }
+    else if(opt == 't' && (strcmp(optarg, "pipe") == 0 || strcmp(optarg, "futex") == 0 || strcmp(optarg, "eventfd") == 0)) {
+      transport = optarg[0] == 'p' ? TRANSPORT_PIPE : optarg[0] == 'f' ? TRANSPORT_FUTEX : TRANSPORT_EVENTFD;
+      transport_given = true;
+      continue;
+    }
+    else if(opt == 'e' && (strcmp(optarg, "process") == 0 || strcmp(optarg, "thread") == 0)) {
+      members = optarg[0] == 'p' ? MEMBER_PROCESS : MEMBER_THREAD;
+      continue;
+    }
+    else if(opt == 'p' && (pipe_size = atoi(optarg)) >= (int)PIPE_BUF) {
+      continue;
+    }
+    else if(opt == 's' && (sweep_last = strtoull(optarg, NULL, 10)) >= 1) {
+      continue;
+    }
+    else if(opt == 'k' && (strcmp(optarg, "scalar") == 0 || strcmp(optarg, "avx2") == 0 || strcmp(optarg, "avx512") == 0)) {
+      kernel = optarg[0] == 's' ? KERNEL_SCALAR : strcmp(optarg, "avx2") == 0 ? KERNEL_AVX2 : KERNEL_AVX512;
+      continue;
+    }
+    else if(opt == 'm') {
+      snprintf(stats_name, sizeof(stats_name), "/%s", optarg);
+      continue;
+    }
+    else if(opt == 'i' && (stats_interval_ms = atoi(optarg)) > 0) {
+      continue;
+    }
+    else if(opt == 'c') {
+      if(parse_cpu_list(optarg) < 0) {
+        return 1;
+      }
+      pin_children = true;
+      continue;
+    }
+    else if(opt == 'a' && (strcmp(optarg, "list") == 0 || strcmp(optarg, "smt") == 0 || strcmp(optarg, "cache") == 0)) {
+      placement = optarg[0] == 'l' ? PLACE_LIST : optarg[0] == 's' ? PLACE_SMT : PLACE_CACHE;
+      pin_children = true;
+      continue;
+    }
+    else if(opt == 'x') {
+      // watch the stats page of a circle running in another process
+      snprintf(stats_name, sizeof(stats_name), "/%s", optarg);
+      return watch_stats(stats_name);
+    }
+    else {
+      fprintf(stderr, "Usage: %s [-b sequences | -r first:end | -f file | -s last [-k scalar|avx2|avx512]] [-w window] [-e process|thread] [-t pipe|futex|eventfd] [-p pipe_bytes] [-m stats_name] [-i stats_ms] [-c cpu_list] [-a list|smt|cache] num_child_processes\n"
+        "       %s [-i ms] -x stats_name (print the stats of a running circle)\n", argv[0], argv[0]);
+      return 1;
+    }
+    // -b and -r build the list of starting values
+    if(range_start < 1 || range_end <= range_start || range_end - range_start > INT_MAX) {
+      fprintf(stderr, "Error: range of starting values must be positive, not empty and at most %d long\n", INT_MAX);
+      return 1;
+    }
+    free(start_values);
+    num_start_values = range_end - range_start;
+    start_values = malloc(sizeof(uint64_t) * num_start_values);
+    if(start_values == NULL) {
+      perror("memory allocation failure");
+      return 1;
+    }
+    for(int i=0; i<num_start_values; i++) {
+      start_values[i] = range_start + i;
+    }
+  }
+  if(argc - optind < 1) { // ensure number of child processes was given
     fprintf(stderr, "Error: must provide valid number of child processes\n");
     return 1;
   }
 
-  int num_child_processes = atoi(argv[1]);
-  if(num_child_processes < 0) { // ensure number of child processes is positive
+  int num_child_processes = atoi(argv[optind]);
+  if(num_child_processes < 1) { // ensure number of child processes is positive
     fprintf(stderr, "Error: number of child processes must be positive\n");
     return 1;
   }
+  if(pin_children && plan_placement() < 0) {
+    return 1;
+  }
+  if(sweep_last > 0) {
+    if(members == MEMBER_THREAD) {
+      fprintf(stderr, "Error: sweep workers are always processes\n");
+      return 1;
+    }
+    return collatz_sweep(sweep_last, num_child_processes);
+  }
+  if(members == MEMBER_THREAD) {
+    // threads share the parent's descriptors, a pipe per link would run out of them long before thousands of members
+    if(transport_given && transport == TRANSPORT_PIPE) {
+      fprintf(stderr, "Error: thread members need a shared memory transport (-t futex or -t eventfd)\n");
+      return 1;
+    }
+    if(!transport_given) {
+      transport = TRANSPORT_FUTEX;
+    }
+  }
+  if(stats_name[0] != '\0' || stats_interval_ms > 0) {
+    message_bytes = sizeof(collatz_message);
+  }
+  // bigger pipes hold more sequences in flight (the rings stay at their fixed size)
+  int max_window = transport == TRANSPORT_PIPE && pipe_size > 0 ? pipe_size / (int)message_bytes : (int)MAX_WINDOW;
+  if(window == 0) {
+    // a benchmark measures one sequence at a time by default, otherwise keep every child busy (as far as the
+    // window can go, only a window asked for with -w is an error when it doesn't fit)
+    window = benchmark ? 1 : 2 * num_child_processes < max_window ? 2 * num_child_processes : max_window;
+  }
+  if(window < 1 || window > max_window) {
+    fprintf(stderr, "Error: window must be between 1 and %d sequences\n", max_window);
+    return 1;
+  }
 
-  // create the pipe array for normal collatz circle communication
-  int **collatz_circle_pipe_array = create_pipe_array(num_child_processes);
-  if(collatz_circle_pipe_array == NULL) {
+  // one pipe shared by all children to tell the parent when a sequence is complete (streaming)
+  if(num_start_values > 0 && pipe(sequence_done_pipe) < 0) {
+    perror("pipe creation failure");
     return 1;
   }
-  // create the pipe array for child processes to report to the parent (A-Level)
-  int **report_to_parent_pipe_array = create_pipe_array(num_child_processes);
-  if(report_to_parent_pipe_array == NULL) {
-    for(int i=0; i<num_child_processes; i++) {
-      free(collatz_circle_pipe_array[i]);
+  if(num_start_values > 0 && pipe_size > 0 && fcntl(sequence_done_pipe[READ], F_SETPIPE_SZ, pipe_size) < 0) {
+    perror("could not resize pipe");
+    return 1;
+  }
+
+  // map the rings and doorbells before forking so every child shares them (shared memory transports)
+  if(transport != TRANSPORT_PIPE && create_shared_rings(num_child_processes) < 0) {
+    return 1;
+  }
+  if(sysconf(_SC_NPROCESSORS_ONLN) == 1) {
+    spin_limit = 0; // the writer can't run while we poll on a single cpu
+  }
+  if((stats_name[0] != '\0' || stats_interval_ms > 0) && create_stats_page(num_child_processes) < 0) {
+    return 1;
+  }
+
+  // create the pipe array for normal collatz circle communication (thread members only use the rings)
+  int **collatz_circle_pipe_array = NULL;
+  if(members == MEMBER_PROCESS && (collatz_circle_pipe_array = create_pipe_array(num_child_processes)) == NULL) {
+    return 1;
+  }
+  for(int i=0; i<num_child_processes && pipe_size > 0 && collatz_circle_pipe_array != NULL; i++) {
+    // a batch can then carry a whole window of sequences in one write
+    if(fcntl(collatz_circle_pipe_array[i][READ], F_SETPIPE_SZ, pipe_size) < 0) {
+      perror("could not resize pipe");
+      return 1;
     }
-    free(collatz_circle_pipe_array);
+  }
+  // create the pipe array for child processes to report to the parent (A-Level), thread members report in memory
+  int **report_to_parent_pipe_array = NULL;
+  if(members == MEMBER_PROCESS && (report_to_parent_pipe_array = create_pipe_array(num_child_processes)) == NULL) {
+    free_pipe_array(collatz_circle_pipe_array, num_child_processes);
     return 1;
   }
 
   // set up the collatz circle based on the desired number of children
-  process_specific_information *ps_info = collatz_circle_create(num_child_processes, collatz_circle_pipe_array, report_to_parent_pipe_array);
+  process_specific_information *ps_info = collatz_circle_create(num_child_processes, collatz_circle_pipe_array, report_to_parent_pipe_array, window);
   if(ps_info == NULL) {
-    for(int i=0; i<num_child_processes; i++) {
-      free(collatz_circle_pipe_array[i]);
-      free(report_to_parent_pipe_array[i]);
-    }
-    free(collatz_circle_pipe_array);
-    free(report_to_parent_pipe_array);
+    free_pipe_array(collatz_circle_pipe_array, num_child_processes);
+    free_pipe_array(report_to_parent_pipe_array, num_child_processes);
     return 1;
   }
 
   // parental loop
   if(ps_info->is_child_process == false) {
-    int initial_number; // stores the initial number entered
+    collatz_message message = {0, 0, 0, 0, 0}; // interactive sequences all use id 0
     pid_t ready_child_pid; // stores the pid of the child that has indicated it is ready
-    int odd_numbers_received, even_numbers_received;
+    int *child_cpus = malloc(sizeof(int) * num_child_processes); // cpu each child actually got, -1 if unpinned
+    if(child_cpus == NULL) {
+      perror("memory allocation failure");
+      return 1;
+    }
 
     // loop to wait for ready message from child before prompting for input
     for(int i=0; i<num_child_processes; i++) {
-      read(report_to_parent_pipe_array[i][READ], &ready_child_pid, sizeof(pid_t));
-      printf("Parent has recieved ready message from PID: %d\n", ready_child_pid);
+      ready_child_pid = await_ready(i, report_to_parent_pipe_array, &child_cpus[i]);
+      if(!benchmark) {
+        printf("Parent has recieved ready message from PID: %d\n", ready_child_pid);
+      }
+    }
+    if(num_placement_cpus > 0 && !benchmark) {
+      printf("Placement:");
+      for(int i=0; i<num_child_processes; i++) {
+        if(child_cpus[i] < 0) {
+          printf(" unpinned");
+        }
+        else {
+          printf(" %d", child_cpus[i]);
+        }
+      }
+      printf("\n");
+    }
+    free(child_cpus);
+
+    if(num_start_values > 0) {
+      collatz_circle_stream(ps_info, start_values, num_start_values, window);
+      collatz_circle_shutdown(num_child_processes, ps_info, report_to_parent_pipe_array);
+      free(start_values);
+      collatz_perform_cleanup(num_child_processes, ps_info, collatz_circle_pipe_array, report_to_parent_pipe_array);
+      return 0;
     }
 
     /* prompt the user for the intial number in the sequence & receive it (initial input only)
@@ -86,35 +484,22 @@ int main(int argc, char *argv[]) {
 
     // core parental loop
     while(true) {
-      scanf("%d", &initial_number);
+      if(scanf("%" SCNu64, &message.value) != 1) {
+        message.value = 0; // treat end of input as the stop condition
+      }
 
-      // write the number to the first child
-      write(ps_info->collatz_fd_write, &initial_number, sizeof(int));
-
-      if(initial_number == 0) { // stop condition
-        int status;
-        // loop to report exit information and receive child status
-        for(int i=0; i<num_child_processes; i++) {
-          // receive pid and count of even/odd numbers received
-          read(report_to_parent_pipe_array[i][READ], &ready_child_pid, sizeof(pid_t));
-          read(report_to_parent_pipe_array[i][READ], &even_numbers_received, sizeof(int));
-          read(report_to_parent_pipe_array[i][READ], &odd_numbers_received, sizeof(int));
-          // close the read end for the pipe
-          close(report_to_parent_pipe_array[i][READ]);
-
-          printf("Child PID: %d Even numbers received: %d Odd numbers received: %d\n", 
-          ready_child_pid, even_numbers_received, odd_numbers_received);
-
-          wait(&status); // wait for children to exit
-        }
-        // close parent process's collatz fd_write (doesn't have collatz fd_read)
-        close(ps_info->collatz_fd_write); 
+      if(message.value == 0) { // stop condition
+        collatz_circle_shutdown(num_child_processes, ps_info, report_to_parent_pipe_array);
 
         // free allocated memory 
         collatz_perform_cleanup(num_child_processes, ps_info, collatz_circle_pipe_array, report_to_parent_pipe_array);
 
         break;
       }
+
+      // write the number to the first child
+      circle_send(ps_info, &message);
+      circle_flush(ps_info);
     }
   }
   else {
@@ -160,7 +545,54 @@ int** create_pipe_array(int num_child_processes) {
   return pipe_array;
 }
 
-process_specific_information* collatz_circle_create(int num_child_processes, int **collatz_circle_pipe_array, int **report_to_parent_pipe_array) {
+void free_pipe_array(int **pipe_array, int num_child_processes) {
+  if(pipe_array == NULL) {
+    return;
+  }
+  for(int i=0; i<num_child_processes; i++) {
+    free(pipe_array[i]);
+  }
+  free(pipe_array);
+}
+
+static bool allocate_batches(process_specific_information *ps_info, int window) {
+  // every sequence in flight plus the stop message fits in one batch
+  ps_info->batch_capacity = window + 1;
+  ps_info->send_batch = malloc(sizeof(collatz_message) * ps_info->batch_capacity);
+  ps_info->done_batch = malloc(sizeof(sequence_result) * ps_info->batch_capacity);
+  ps_info->receive_buffer = malloc(sizeof(collatz_message) * ps_info->batch_capacity);
+  ps_info->send_count = ps_info->done_count = 0;
+  ps_info->receive_start = ps_info->receive_end = 0;
+  if(ps_info->send_batch == NULL || ps_info->done_batch == NULL || ps_info->receive_buffer == NULL) {
+    perror("memory allocation failure");
+    free(ps_info->send_batch);
+    free(ps_info->done_batch);
+    free(ps_info->receive_buffer);
+    return false;
+  }
+  return true;
+}
+
+static void member_start(process_specific_information *ps_info) {
+  // first thing a new member of the circle does, in the child process or thread itself
+  int i = ps_info->ring_read;
+  ps_info->cpu = place_child(i);
+  if(transport != TRANSPORT_PIPE) {
+    // fault in the pages of the ring we read (and its doorbell) now that we're on our cpu, so they come from our
+    // numa node, nobody writes to them before the parent has heard that every child is ready
+    memset(ring_of(i), 0, ring_stride);
+    if(ps_info->ring_inject >= 0) {
+      memset(ring_of(ps_info->ring_inject), 0, ring_stride);
+    }
+  }
+  if(stats != NULL) {
+    ps_info->stats = &stats->children[i];
+    atomic_store(&ps_info->stats->pid, gettid());
+    atomic_store(&ps_info->stats->started_ns, now_ns());
+  }
+}
+
+process_specific_information* collatz_circle_create(int num_child_processes, int **collatz_circle_pipe_array, int **report_to_parent_pipe_array, int window) {
 
   pid_t pid;
   process_specific_information *ps_info = malloc(sizeof(process_specific_information));
@@ -172,15 +604,45 @@ process_specific_information* collatz_circle_create(int num_child_processes, int
 
   ps_info->is_child_process = false;
   ps_info->wraps_around_circle = false;
+  // the parent injects on the extra ring, which only child 0 reads
+  ps_info->ring_read = -1;
+  ps_info->ring_inject = num_child_processes;
+  ps_info->ring_write = num_child_processes;
+  ps_info->stats = NULL;
+  ps_info->report = NULL;
+  if(!allocate_batches(ps_info, window)) {
+    free(ps_info);
+    return NULL;
+  }
+
+  if(members == MEMBER_THREAD) {
+    ps_info->collatz_fd_write = -1; // the parent only injects on its ring
+    if(start_member_threads(num_child_processes, window) < 0) {
+      free(ps_info->send_batch);
+      free(ps_info->done_batch);
+      free(ps_info->receive_buffer);
+      free(ps_info);
+      return NULL;
+    }
+    return ps_info;
+  }
   
   for(int i=0; i<num_child_processes; i++) { // loop to create desired number of child processes
     if((pid = fork()) < 0) {
       perror("fork failure");
+      free(ps_info->send_batch);
+      free(ps_info->done_batch);
+      free(ps_info->receive_buffer);
       free(ps_info); // free allocated memory (caller will free pipe arrays)
       return NULL;
     }
     else if(pid == 0) { // setup child process
       ps_info->is_child_process = true;
+      // child i reads ring i and writes ring i + 1 (wrapping around), child 0 also reads the parent's ring
+      ps_info->ring_read = i;
+      ps_info->ring_inject = i == 0 ? num_child_processes : -1;
+      ps_info->ring_write = (i + 1) % num_child_processes;
+      member_start(ps_info);
       // need to close all pipes not used by the given child
       for(int j=0; j<num_child_processes; j++) {
         // close the read end of all pipes for reporting to parent
@@ -213,6 +675,10 @@ process_specific_information* collatz_circle_create(int num_child_processes, int
           }
         }
       }
+      if(num_start_values > 0) {
+        close(sequence_done_pipe[READ]); // only the parent reads sequence completions
+        ps_info->sequence_done_fd_write = sequence_done_pipe[WRITE];
+      }
       break; // only the parent process should create children
     }
   }
@@ -227,86 +693,1391 @@ process_specific_information* collatz_circle_create(int num_child_processes, int
       // close the write end of all pipes for reporting to parent (should only read)
       close(report_to_parent_pipe_array[i][WRITE]);
     }
+    if(num_start_values > 0) {
+      close(sequence_done_pipe[WRITE]); // the parent only reads sequence completions
+    }
   }
   return ps_info;
 }
 
 void collatz_circle_loop(process_specific_information *ps_info) {
-  int collatz_value;
+  collatz_message message;
+  char term[40]; // a 128-bit term in decimal
   int odd_numbers_received = 0;
   int even_numbers_received = 0;
+  bool demo = num_start_values == 0; // the sleeps and per-term output are only for watching the circle
 
-  usleep(1000000);
+  if(demo) {
+    usleep(1000000);
+  }
 
-  // send initial ready message to the parent
-  pid_t pid = getpid();
-  write(ps_info->report_to_parent_fd_write, &pid, sizeof(pid_t));
+  // send initial ready message to the parent (a child process is a single thread, so its thread id is its pid)
+  pid_t pid = gettid();
+  report_ready(ps_info, pid);
 
   // core child loop
   while(true) {
-    usleep(1000000);
+    if(demo) {
+      usleep(1000000);
 
-    printf("Child %d is ready\n", pid);
+      printf("Child %d is ready\n", pid);
 
-    usleep(1000000);
+      usleep(1000000);
+    }
 
-    read(ps_info->collatz_fd_read, &collatz_value, sizeof(int));
+    circle_receive(ps_info, &message);
     
-    printf("Child %d has received: %d\n", pid, collatz_value);
+    if(demo) {
+      printf("Child %d has received: %s\n", pid, collatz_term_string(&message, term));
 
-    usleep(1000000);
+      usleep(1000000);
+    }
 
-    if(collatz_value == 0) {
+    if(message.value == 0 && message.high == 0) {
       // prevent the last process from writing 0 back around
       if(!ps_info->wraps_around_circle) { 
-        write(ps_info->collatz_fd_write, &collatz_value, sizeof(int));
+        circle_send(ps_info, &message);
+      }
+      else {
+        // child 0 has already stopped reading, so drop what would have gone back around with the sequence
+        ps_info->send_count = 0;
+      }
+      circle_flush(ps_info); // nothing else may be left behind in the batches
+      if(ps_info->stats != NULL) {
+        atomic_store(&ps_info->stats->stopped_ns, now_ns());
+      }
+      if(ps_info->report == NULL) { // thread members have no pipes of their own
+        close(ps_info->collatz_fd_read); // close this process's read pipe
+        close(ps_info->collatz_fd_write); // close this process's write pipe
       }
-      close(ps_info->collatz_fd_read); // close this process's read pipe
-      close(ps_info->collatz_fd_write); // close this process's write pipe
 
       // write even & odd numbers recieved to the parent
-      write(ps_info->report_to_parent_fd_write, &pid, sizeof(pid_t));
-      write(ps_info->report_to_parent_fd_write, &even_numbers_received, sizeof(int));
-      write(ps_info->report_to_parent_fd_write, &odd_numbers_received, sizeof(int));
-      close(ps_info->report_to_parent_fd_write); // close the pipe to write to the parent
+      report_counts(ps_info, pid, even_numbers_received, odd_numbers_received);
 
-      printf("Child %d is done\n", pid);
+      if(demo) {
+        printf("Child %d is done\n", pid);
+      }
+      else if(ps_info->report == NULL) {
+        close(ps_info->sequence_done_fd_write); // thread members share the parent's, it closes it once they're joined
+      }
       break;
     }
 
-    if(collatz_value % 2 == 0) {
+    if(message.value % 2 == 0) {
       even_numbers_received++; // number is even, increment even counter
     }
     else {
       odd_numbers_received++; // number is odd, increment odd counter
     }
 
-    if(collatz_value != 1) { // send to next child if number is not a 1
-      collatz_value = collatz_next_term(collatz_value);
-      write(ps_info->collatz_fd_write, &collatz_value, sizeof(int));
+    if(message.value != 1 || message.high != 0) { // send to next child if number is not a 1
+      if(!collatz_advance(&message)) {
+        // the term outgrew 128 bits, give up on this sequence
+        if(demo) {
+          printf("Child %d: next term overflows 128 bits\n", pid);
+          printf("Enter first number in sequence:\n");
+        }
+        else {
+          sequence_result result = {message.sequence_id, STEPS_OVERFLOWED};
+          report_sequence_done(ps_info, &result);
+        }
+        continue;
+      }
+      circle_send(ps_info, &message);
+      if(demo) {
+        circle_flush(ps_info); // pass each term on as it is computed so the circle can be watched
+      }
     }
-    else {
+    else if(demo) {
       // ensures sequence is complete before prompting again (prevents parent from prompting instantly)
       printf("Enter first number in sequence:\n"); 
     }
+    else {
+      // let the parent record the stopping time and feed in another sequence
+      sequence_result result = {message.sequence_id, message.steps};
+      report_sequence_done(ps_info, &result);
+    }
+  }
+}
+
+bool collatz_next_term(uint64_t previous_term, uint64_t *next_term) {
+  // calculate what the next number should be based on the collatz conjecture, false if 3n + 1 overflows
+  if(previous_term % 2 == 0) {
+    *next_term = previous_term / 2;
+    return true;
   }
+  return !__builtin_mul_overflow(previous_term, 3, next_term) && !__builtin_add_overflow(*next_term, 1, next_term);
 }
 
-int collatz_next_term(int previous_term) {
-  // calculate what the next number should be based on the collatz conjecture
+bool collatz_next_term_wide(unsigned __int128 previous_term, unsigned __int128 *next_term) {
+  // the same for a term that needs 128 bits
   if(previous_term % 2 == 0) {
-    return previous_term / 2;
+    *next_term = previous_term / 2;
+    return true;
   }
-  return (previous_term * 3) + 1;
+  return !__builtin_mul_overflow(previous_term, 3, next_term) && !__builtin_add_overflow(*next_term, 1, next_term);
+}
+
+bool collatz_advance(collatz_message *message) {
+  // replace the message's term with the next one, widening it only when it no longer fits in 64 bits
+  uint64_t next;
+  if(message->high == 0 && collatz_next_term(message->value, &next)) {
+    message->value = next;
+    message->steps++;
+    return true;
+  }
+  unsigned __int128 wide = ((unsigned __int128)message->high << 64) | message->value;
+  if(!collatz_next_term_wide(wide, &wide)) {
+    return false;
+  }
+  message->value = (uint64_t)wide;
+  message->high = (uint64_t)(wide >> 64); // back to the fast path once the trajectory drops below 2^64
+  message->steps++;
+  return true;
+}
+
+char* collatz_term_string(const collatz_message *message, char *buffer) {
+  // decimal form of the message's term, buffer must hold 40 characters
+  unsigned __int128 term = ((unsigned __int128)message->high << 64) | message->value;
+  char digits[40];
+  int n = 0;
+  do {
+    digits[n++] = '0' + term % 10;
+    term /= 10;
+  } while(term > 0);
+  for(int i=0; i<n; i++) {
+    buffer[i] = digits[n - 1 - i];
+  }
+  buffer[n] = '\0';
+  return buffer;
 }
 
 void collatz_perform_cleanup(int num_child_processes, process_specific_information *ps_info, int **collatz_circle_pipe_array, int **report_to_parent_pipe_array) {
   // free all allocated memory
-  for(int i=0; i<num_child_processes; i++) {
-    free(collatz_circle_pipe_array[i]);
-    free(report_to_parent_pipe_array[i]);
+  free_pipe_array(collatz_circle_pipe_array, num_child_processes);
+  free_pipe_array(report_to_parent_pipe_array, num_child_processes);
+  if(members == MEMBER_THREAD) {
+    free(thread_members); // every thread freed its own batches before it was joined
+    free(member_reports);
+    free(member_threads);
+  }
+  free(ps_info->send_batch);
+  free(ps_info->done_batch);
+  free(ps_info->receive_buffer);
+  if(stats != NULL) {
+    if(!ps_info->is_child_process) {
+      unlink_stats_page();
+    }
+    munmap(stats, stats_size);
   }
-  free(collatz_circle_pipe_array);
-  free(report_to_parent_pipe_array);
   free(ps_info);
+  if(transport != TRANSPORT_PIPE) {
+    munmap(rings, shared_rings_size);
+  }
+  if(transport == TRANSPORT_EVENTFD) {
+    for(int i=0; i<num_child_processes; i++) {
+      close(doorbell_fds[i]);
+    }
+    free(doorbell_fds);
+  }
+}
+
+uint64_t* read_start_values(const char *path, int *count) {
+  // read whitespace separated starting values from a file
+  FILE *file = fopen(path, "r");
+  if(file == NULL) {
+    perror("could not open file of starting values");
+    return NULL;
+  }
+  int capacity = 1024;
+  uint64_t *values = malloc(sizeof(uint64_t) * capacity);
+  uint64_t value;
+  *count = 0;
+  while(values != NULL && (errno = 0, fscanf(file, "%" SCNu64, &value)) == 1) {
+    if(errno == ERANGE) {
+      fprintf(stderr, "Error: starting value does not fit in 64 bits\n");
+      free(values);
+      fclose(file);
+      return NULL;
+    }
+    if(value < 1) {
+      fprintf(stderr, "Error: starting value %" PRIu64 " is not positive\n", value);
+      free(values);
+      fclose(file);
+      return NULL;
+    }
+    if(*count == capacity) {
+      capacity *= 2;
+      uint64_t *grown = realloc(values, sizeof(uint64_t) * capacity);
+      if(grown == NULL) {
+        free(values);
+      }
+      values = grown;
+    }
+    if(values != NULL) {
+      values[(*count)++] = value;
+    }
+  }
+  fclose(file);
+  if(values == NULL) {
+    perror("memory allocation failure");
+    return NULL;
+  }
+  if(*count == 0) {
+    fprintf(stderr, "Error: no starting values in %s\n", path);
+    free(values);
+    return NULL;
+  }
+  return values;
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void collatz_circle_stream(process_specific_information *ps_info, const uint64_t *start_values, int num_start_values, int window) {
+  // keep up to window sequences travelling around the circle at once, starting a new one as each reaches 1
+  uint64_t *sent_ns = malloc(sizeof(uint64_t) * num_start_values); // when each sequence entered the circle
+  uint64_t latency_ns = 0;
+  long total_terms = 0;
+  int next = 0, done = 0, in_flight = 0, overflowed = 0;
+  sequence_result *results = malloc(sizeof(sequence_result) * window);
+  sequence_result longest = {0, -1};
+
+  if(sent_ns == NULL || results == NULL) {
+    free(sent_ns);
+    free(results);
+    perror("memory allocation failure");
+    return;
+  }
+
+  uint64_t start = now_ns();
+  uint64_t next_sample = start + stats_interval_ms * 1000000ull;
+  while(done < num_start_values) {
+    if(stats_interval_ms > 0 && now_ns() >= next_sample) {
+      print_stats(stats);
+      next_sample += stats_interval_ms * 1000000ull;
+    }
+    while(in_flight < window && next < num_start_values) {
+      collatz_message message = {next, 0, start_values[next], 0, 0};
+      sent_ns[next] = now_ns();
+      circle_send(ps_info, &message);
+      next++;
+      in_flight++;
+    }
+    circle_flush(ps_info); // the whole refill goes out at once
+
+    // take every completion that has arrived, each child writes whole batches of them
+    ssize_t bytes = read(sequence_done_pipe[READ], results, sizeof(sequence_result) * window);
+    uint64_t now = now_ns();
+    for(int i=0; i<(int)(bytes / (ssize_t)sizeof(sequence_result)); i++) {
+      sequence_result result = results[i];
+      done++;
+      in_flight--;
+      if(result.steps == STEPS_OVERFLOWED) {
+        fprintf(stderr, "Start: %" PRIu64 " overflowed 128 bits\n", start_values[result.sequence_id]);
+        overflowed++;
+        continue;
+      }
+      latency_ns += now - sent_ns[result.sequence_id];
+      total_terms += result.steps + 1; // the starting value is received too
+      if(result.steps > longest.steps) {
+        longest = result;
+      }
+      if(!benchmark) {
+        printf("Start: %" PRIu64 " Stopping time: %d\n", start_values[result.sequence_id], result.steps);
+      }
+    }
+  }
+  double seconds = (now_ns() - start) / 1e9;
+  close(sequence_done_pipe[READ]);
+  if(stats_interval_ms > 0) {
+    print_stats(stats);
+  }
+
+  // every term is one hop, so hop latency is the time sequences spent in the circle spread over their terms
+  static const char *transport_names[] = {"pipe", "futex", "eventfd"};
+  printf("Members: %s Transport: %s Window: %d Sequences: %d Terms: %ld Longest: %" PRIu64 " (%d steps)\n",
+    members == MEMBER_THREAD ? "thread" : "process", transport_names[transport], window, num_start_values, total_terms, start_values[longest.sequence_id], longest.steps);
+  if(overflowed > 0) {
+    printf("Overflowed: %d\n", overflowed);
+  }
+  printf("Elapsed: %.6f s Terms/sec: %.0f Mean hop latency: %.0f ns\n", seconds, total_terms / seconds,
+    (double)latency_ns / total_terms);
+  free(sent_ns);
+  free(results);
+}
+
+void collatz_circle_shutdown(int num_child_processes, process_specific_information *ps_info, int **report_to_parent_pipe_array) {
+  // send the stop value around the circle, then collect each child's report and wait for it to exit
+  collatz_message message = {0, 0, 0, 0, 0};
+  pid_t child_pid;
+  int odd_numbers_received, even_numbers_received;
+  int status;
+
+  circle_send(ps_info, &message);
+  circle_flush(ps_info);
+
+  // loop to report exit information and receive child status
+  for(int i=0; i<num_child_processes; i++) {
+    // receive pid and count of even/odd numbers received
+    child_pid = await_counts(i, report_to_parent_pipe_array, &even_numbers_received, &odd_numbers_received);
+
+    if(!benchmark) {
+      printf("Child PID: %d Even numbers received: %d Odd numbers received: %d\n", 
+      child_pid, even_numbers_received, odd_numbers_received);
+    }
+
+    if(members == MEMBER_THREAD) {
+      pthread_join(member_threads[i], NULL);
+    }
+    else {
+      wait(&status); // wait for children to exit
+    }
+  }
+  if(members == MEMBER_THREAD && num_start_values > 0) {
+    close(sequence_done_pipe[WRITE]); // every thread member is gone, nothing else writes to it
+  }
+  if(stats != NULL) {
+    atomic_store(&stats->running, 0); // lets -x know the circle is gone
+  }
+  // close parent process's collatz fd_write (doesn't have collatz fd_read)
+  if(members == MEMBER_PROCESS) {
+    close(ps_info->collatz_fd_write); 
+  }
+}
+
+int create_shared_rings(int num_child_processes) {
+  // one anonymous shared mapping for every ring and doorbell, inherited by the children across fork(), each ring
+  // and its doorbell start a page of their own so the child reading them is the first (and only) one to fault them in
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  ring_stride = (sizeof(message_ring) + sizeof(doorbell) + page_size - 1) / page_size * page_size;
+  shared_rings_size = ring_stride * (num_child_processes + 1);
+  rings = mmap(NULL, shared_rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(rings == MAP_FAILED) {
+    perror("mmap failure");
+    return -1;
+  }
+  // the mapping starts zeroed, so every ring is empty
+
+  if(transport == TRANSPORT_EVENTFD) {
+    doorbell_fds = malloc(sizeof(int) * num_child_processes);
+    if(doorbell_fds == NULL) {
+      perror("memory allocation failure");
+      munmap(rings, shared_rings_size);
+      return -1;
+    }
+    for(int i=0; i<num_child_processes; i++) {
+      if((doorbell_fds[i] = eventfd(0, 0)) < 0) {
+        perror("eventfd creation failure");
+        for(int j=0; j<i; j++) {
+          close(doorbell_fds[j]);
+        }
+        free(doorbell_fds);
+        munmap(rings, shared_rings_size);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static inline message_ring* ring_of(int index) {
+  return (message_ring *)((char *)rings + ring_stride * index);
+}
+
+static inline doorbell* doorbell_of(int index) {
+  // right after the ring in the same pages (the parent's extra ring has one too, nobody rings it)
+  return (doorbell *)((char *)ring_of(index) + sizeof(message_ring));
+}
+
+static inline void cpu_relax() {
+  // tell the cpu we are in a polling loop (saves power and frees the sibling hyperthread)
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
+
+void circle_send(process_specific_information *ps_info, const collatz_message *message) {
+  // pass a message to the next member of the circle
+  collatz_message stamped;
+  if(stats != NULL) {
+    stamped = *message;
+    stamped.sent_ns = now_ns();
+    message = &stamped;
+    if(ps_info->stats != NULL) {
+      atomic_store_explicit(&ps_info->stats->bytes_sent,
+        atomic_load_explicit(&ps_info->stats->bytes_sent, memory_order_relaxed) + message_bytes, memory_order_relaxed);
+    }
+  }
+  if(transport == TRANSPORT_PIPE) {
+    // held back until the process is about to block, see circle_flush
+    if(ps_info->send_count == ps_info->batch_capacity) {
+      circle_flush(ps_info);
+    }
+    memcpy(ps_info->send_batch + message_bytes * ps_info->send_count++, message, message_bytes);
+    return;
+  }
+  message_ring *ring = ring_of(ps_info->ring_write);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed); // only we write tail
+
+  // the window keeps every ring below capacity, only a fast typist in interactive mode could get here
+  while(tail - atomic_load_explicit(&ring->head, memory_order_acquire) == RING_SLOTS) {
+    sched_yield();
+  }
+  ring->slots[tail % RING_SLOTS] = *message;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+  // ring the reader's doorbell, but only pay for the syscall if it is asleep (the injection ring is read by child 0)
+  int reader = ps_info->ring_write == ps_info->ring_inject ? 0 : ps_info->ring_write;
+  doorbell *bell = doorbell_of(reader);
+  atomic_thread_fence(memory_order_seq_cst); // pairs with the reader's sleeping flag before its last check
+  if(atomic_load_explicit(&bell->sleeping, memory_order_relaxed)) {
+    if(transport == TRANSPORT_FUTEX) {
+      atomic_fetch_add_explicit(&bell->wake_seq, 1, memory_order_release);
+      syscall(SYS_futex, &bell->wake_seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+    else {
+      uint64_t one = 1;
+      write(doorbell_fds[reader], &one, sizeof(uint64_t));
+    }
+  }
+}
+
+static bool ring_pop(message_ring *ring, collatz_message *message) {
+  // take the oldest message off a ring, false if it is empty
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed); // only we write head
+  if(head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+    return false;
+  }
+  *message = ring->slots[head % RING_SLOTS];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+static void stats_blocked(child_stats *counters, bool blocked) {
+  // bracket a wait for a message, so the time spent in it counts as blocked
+  if(counters == NULL) {
+    return;
+  }
+  uint64_t now = now_ns();
+  if(blocked) {
+    atomic_store_explicit(&counters->blocked_since, now, memory_order_relaxed);
+    return;
+  }
+  uint64_t since = atomic_load_explicit(&counters->blocked_since, memory_order_relaxed);
+  atomic_store_explicit(&counters->blocked_ns, atomic_load_explicit(&counters->blocked_ns, memory_order_relaxed) + now - since,
+    memory_order_relaxed);
+  atomic_store_explicit(&counters->blocked_since, 0, memory_order_relaxed);
+}
+
+static void stats_received(child_stats *counters, const collatz_message *message, uint32_t depth) {
+  // count a message we just took off the circle, depth is how many more are already waiting
+  if(counters == NULL) {
+    return;
+  }
+  atomic_store_explicit(&counters->messages, atomic_load_explicit(&counters->messages, memory_order_relaxed) + 1,
+    memory_order_relaxed);
+  atomic_store_explicit(&counters->bytes_received,
+    atomic_load_explicit(&counters->bytes_received, memory_order_relaxed) + message_bytes, memory_order_relaxed);
+  atomic_store_explicit(&counters->queue_depth, depth, memory_order_relaxed);
+  if(depth > atomic_load_explicit(&counters->max_queue_depth, memory_order_relaxed)) {
+    atomic_store_explicit(&counters->max_queue_depth, depth, memory_order_relaxed);
+  }
+  uint64_t latency = message->sent_ns > 0 ? now_ns() - message->sent_ns : 0;
+  if(latency > atomic_load_explicit(&counters->max_latency_ns, memory_order_relaxed)) {
+    atomic_store_explicit(&counters->max_latency_ns, latency, memory_order_relaxed);
+  }
+}
+
+void circle_receive(process_specific_information *ps_info, collatz_message *message) {
+  // wait for the next message from the previous member of the circle (or from the parent, for child 0)
+  if(transport == TRANSPORT_PIPE) {
+    // hand out what the last read brought in, only read again (once everything we owe has gone out) when it's used up
+    while(ps_info->receive_end - ps_info->receive_start < message_bytes) {
+      circle_flush(ps_info);
+      // a batch bigger than PIPE_BUF can arrive in pieces, keep the partial message for the next read
+      size_t partial = ps_info->receive_end - ps_info->receive_start;
+      memmove(ps_info->receive_buffer, ps_info->receive_buffer + ps_info->receive_start, partial);
+      ps_info->receive_start = 0;
+      ps_info->receive_end = partial;
+      stats_blocked(ps_info->stats, true);
+      ssize_t bytes = read(ps_info->collatz_fd_read, ps_info->receive_buffer + partial,
+        message_bytes * ps_info->batch_capacity - partial);
+      stats_blocked(ps_info->stats, false);
+      if(bytes <= 0) {
+        *message = (collatz_message){0, 0, 0, 0, 0}; // every writer is gone, treat it as the stop message
+        return;
+      }
+      ps_info->receive_end += bytes;
+    }
+    message->sent_ns = 0; // unless the message carries it
+    memcpy(message, ps_info->receive_buffer + ps_info->receive_start, message_bytes);
+    ps_info->receive_start += message_bytes;
+    // only what has been read in so far is known without another syscall
+    stats_received(ps_info->stats, message, (ps_info->receive_end - ps_info->receive_start) / message_bytes);
+    return;
+  }
+  message_ring *ring = ring_of(ps_info->ring_read);
+  message_ring *inject = ps_info->ring_inject >= 0 ? ring_of(ps_info->ring_inject) : NULL;
+  doorbell *bell = doorbell_of(ps_info->ring_read);
+
+  for(int spins = 0; ; spins++) {
+    // sequences already in the circle come first, new ones from the parent after
+    if(ring_pop(ring, message) || (inject != NULL && ring_pop(inject, message))) {
+      if(ps_info->stats != NULL) {
+        if(spins > 0) {
+          stats_blocked(ps_info->stats, false);
+        }
+        uint32_t depth = atomic_load_explicit(&ring->tail, memory_order_relaxed) - atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if(inject != NULL) {
+          depth += atomic_load_explicit(&inject->tail, memory_order_relaxed) - atomic_load_explicit(&inject->head, memory_order_relaxed);
+        }
+        stats_received(ps_info->stats, message, depth);
+      }
+      return;
+    }
+    if(spins == 0) {
+      circle_flush(ps_info); // completions are still batched on the pipe to the parent
+      stats_blocked(ps_info->stats, true); // polling counts as blocked too
+    }
+    if(spins < spin_limit) {
+      cpu_relax();
+      continue;
+    }
+
+    // announce that we are going to sleep, then check once more so a writer either sees the flag or we see its message
+    unsigned int seq = atomic_load_explicit(&bell->wake_seq, memory_order_acquire);
+    atomic_store(&bell->sleeping, 1);
+    if(atomic_load(&ring->tail) == atomic_load_explicit(&ring->head, memory_order_relaxed) &&
+       (inject == NULL || atomic_load(&inject->tail) == atomic_load_explicit(&inject->head, memory_order_relaxed))) {
+      if(transport == TRANSPORT_FUTEX) {
+        syscall(SYS_futex, &bell->wake_seq, FUTEX_WAIT, seq, NULL, NULL, 0); // returns at once if seq moved on
+      }
+      else {
+        uint64_t count;
+        read(doorbell_fds[ps_info->ring_read], &count, sizeof(uint64_t));
+      }
+    }
+    atomic_store_explicit(&bell->sleeping, 0, memory_order_relaxed);
+  }
+}
+
+static void write_all(int fd, const void *data, size_t bytes, size_t atomic_bytes) {
+  // write a batch, in pieces no bigger than atomic_bytes so other writers to the pipe can't split a message
+  const char *next = data;
+  while(bytes > 0) {
+    ssize_t written = write(fd, next, bytes < atomic_bytes ? bytes : atomic_bytes);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      perror("write failure");
+      return;
+    }
+    next += written;
+    bytes -= written;
+  }
+}
+
+void circle_flush(process_specific_information *ps_info) {
+  // send everything batched up so far, one write per batch
+  if(ps_info->send_count > 0) {
+    // the parent and the child that wraps around share pipe 0, everyone else has its pipe to itself
+    bool shared = !ps_info->is_child_process || ps_info->wraps_around_circle;
+    write_all(ps_info->collatz_fd_write, ps_info->send_batch, message_bytes * ps_info->send_count,
+      shared ? message_bytes * ATOMIC_MESSAGES : SIZE_MAX);
+    ps_info->send_count = 0;
+  }
+  if(ps_info->done_count > 0) {
+    write_all(ps_info->sequence_done_fd_write, ps_info->done_batch, sizeof(sequence_result) * ps_info->done_count,
+      sizeof(sequence_result) * ATOMIC_RESULTS);
+    ps_info->done_count = 0;
+  }
+}
+
+void report_sequence_done(process_specific_information *ps_info, const sequence_result *result) {
+  // let the parent know a sequence reached 1, batched like the messages
+  if(ps_info->done_count == ps_info->batch_capacity) {
+    circle_flush(ps_info);
+  }
+  ps_info->done_batch[ps_info->done_count++] = *result;
+}
+
+static void sweep_lock(sweep_worker *worker) {
+  while(atomic_flag_test_and_set_explicit(&worker->lock, memory_order_acquire)) {
+    sched_yield(); // only held for a few instructions, but the holder may have been preempted
+  }
+}
+
+static void sweep_unlock(sweep_worker *worker) {
+  atomic_flag_clear_explicit(&worker->lock, memory_order_release);
+}
+
+static bool sweep_claim(sweep_worker *workers, int num_workers, int self, uint64_t *first, uint64_t *end) {
+  // next chunk of our own range, or failing that the upper half of the biggest range left (false once all are empty)
+  sweep_worker *worker = &workers[self];
+  sweep_lock(worker);
+  if(worker->next < worker->end) {
+    *first = worker->next;
+    *end = worker->next + SWEEP_CHUNK < worker->end ? worker->next + SWEEP_CHUNK : worker->end;
+    worker->next = *end;
+    sweep_unlock(worker);
+    return true;
+  }
+  sweep_unlock(worker);
+
+  while(true) {
+    // pick the victim without locking, then check again under its lock
+    int victim = -1;
+    uint64_t most = 0;
+    for(int i=0; i<num_workers; i++) {
+      uint64_t left = workers[i].end - workers[i].next;
+      if(workers[i].next < workers[i].end && left > most) {
+        most = left;
+        victim = i;
+      }
+    }
+    if(victim < 0) {
+      return false;
+    }
+    sweep_lock(&workers[victim]);
+    if(workers[victim].next < workers[victim].end) {
+      uint64_t left = workers[victim].end - workers[victim].next;
+      uint64_t middle = workers[victim].end - (left + 1) / 2;
+      uint64_t stolen_end = workers[victim].end;
+      workers[victim].end = middle;
+      sweep_unlock(&workers[victim]);
+
+      // keep the first chunk, the rest of the stolen half becomes our range (and can be stolen in turn)
+      *first = middle;
+      *end = middle + SWEEP_CHUNK < stolen_end ? middle + SWEEP_CHUNK : stolen_end;
+      sweep_lock(worker);
+      worker->next = *end;
+      worker->end = stolen_end;
+      worker->steals++;
+      sweep_unlock(worker);
+      return true;
+    }
+    sweep_unlock(&workers[victim]);
+  }
+}
+
+static int sweep_stopping_time(uint64_t start, uint64_t value, int steps, _Atomic uint16_t *memo, uint64_t memo_entries,
+  unsigned __int128 *highest_odd) {
+  // stopping time of start, picking up its trajectory at value after steps (the vector kernels hand over lanes this way),
+  // cut short as soon as the trajectory reaches a value whose stopping time is remembered
+  while(value != 1) {
+    if(value < start && value < memo_entries) {
+      // everything below start is (being) swept, so its stopping time may already be known
+      int known = atomic_load_explicit(&memo[value], memory_order_relaxed);
+      if(known > 0) {
+        steps += known;
+        break;
+      }
+    }
+    if(value % 2 == 0) {
+      int zeros = __builtin_ctzll(value); // every trailing zero is one halving
+      value >>= zeros;
+      steps += zeros;
+      continue;
+    }
+    if(value > *highest_odd) {
+      *highest_odd = value;
+    }
+    // 3n + 1 is always even, so take it and the halving after it as one step: (3n + 1) / 2 = n + n / 2 + 1
+    uint64_t next;
+    if(!__builtin_add_overflow(value, value / 2 + 1, &next)) {
+      value = next;
+      steps += 2;
+      continue;
+    }
+    // the trajectory leaves 64 bits, follow it with 128 until it comes back down
+    unsigned __int128 wide = value;
+    do {
+      if(wide % 2 == 1 && wide > *highest_odd) {
+        *highest_odd = wide;
+      }
+      if(!collatz_next_term_wide(wide, &wide)) {
+        return STEPS_OVERFLOWED;
+      }
+      steps++;
+    } while(wide > UINT64_MAX);
+    value = (uint64_t)wide;
+  }
+  return steps;
+}
+
+static void sweep_finish(sweep_worker *worker, _Atomic uint16_t *memo, uint64_t memo_entries, uint64_t start, int steps,
+  unsigned __int128 highest_odd) {
+  // remember start's stopping time for later trajectories and add it to the worker's findings
+  worker->swept++;
+  if(highest_odd > worker->highest_odd || (highest_odd == worker->highest_odd && start < worker->highest_start)) {
+    worker->highest_odd = highest_odd;
+    worker->highest_start = start;
+  }
+  if(steps == STEPS_OVERFLOWED) {
+    fprintf(stderr, "Start: %" PRIu64 " overflowed 128 bits\n", start);
+    worker->overflowed++;
+    return;
+  }
+  if(start < memo_entries && steps <= UINT16_MAX) {
+    atomic_store_explicit(&memo[start], (uint16_t)steps, memory_order_relaxed);
+  }
+  if(steps > worker->longest_steps) {
+    worker->longest_steps = steps;
+    worker->longest_start = start;
+  }
+  worker->histogram[steps / HISTOGRAM_WIDTH < HISTOGRAM_BUCKETS ? steps / HISTOGRAM_WIDTH : HISTOGRAM_BUCKETS - 1]++;
+}
+
+static void sweep_work(sweep_worker *workers, int num_workers, int self, _Atomic uint16_t *memo, uint64_t memo_entries) {
+  sweep_worker *worker = &workers[self];
+  uint64_t first, end;
+  while(sweep_claim(workers, num_workers, self, &first, &end)) {
+    for(uint64_t start = first; start < end; start++) {
+      unsigned __int128 highest_odd = 0; // highest odd term seen on this trajectory
+      int steps = sweep_stopping_time(start, start, 0, memo, memo_entries, &highest_odd);
+      sweep_finish(worker, memo, memo_entries, start, steps, highest_odd);
+    }
+  }
+}
+
+// the vector kernels step SWEEP_LANES trajectories at once, one per 64-bit lane (4 avx2 or 2 avx512 registers' worth)
+#define SWEEP_LANES 16
+// lanes are signed, avx2 only compares signed 64-bit integers, so a lane above this is handed to the scalar code
+// (which can follow it past 64 bits) while (3n + 1) / 2 still fits
+#define SWEEP_LANE_LIMIT (INT64_MAX / 3)
+// vector steps between looks at whether any lane needs the scalar code
+#define SWEEP_ROUNDS 8
+
+// a vector kernel steps every lane until at least one drops below its target or passes SWEEP_LANE_LIMIT, and returns
+// a bit per such lane (a lane stops moving once flagged)
+typedef unsigned int (*sweep_step_fn)(int64_t *value, const int64_t *target, int64_t *steps, int64_t *highest_odd);
+
+__attribute__((target("avx2"))) static unsigned int sweep_step_avx2(int64_t *value, const int64_t *target, int64_t *steps,
+  int64_t *highest_odd) {
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i limit = _mm256_set1_epi64x(SWEEP_LANE_LIMIT);
+  __m256i v[SWEEP_LANES / 4], t[SWEEP_LANES / 4], s[SWEEP_LANES / 4], h[SWEEP_LANES / 4], flagged[SWEEP_LANES / 4];
+  for(int i = 0; i < SWEEP_LANES / 4; i++) {
+    v[i] = _mm256_load_si256((const __m256i *)&value[4 * i]);
+    t[i] = _mm256_load_si256((const __m256i *)&target[4 * i]);
+    s[i] = _mm256_load_si256((const __m256i *)&steps[4 * i]);
+    h[i] = _mm256_load_si256((const __m256i *)&highest_odd[4 * i]);
+    flagged[i] = _mm256_setzero_si256();
+  }
+  unsigned int mask = 0;
+  while(mask == 0) {
+    for(int round = 0; round < SWEEP_ROUNDS; round++) {
+      for(int i = 0; i < SWEEP_LANES / 4; i++) {
+        __m256i odd = _mm256_andnot_si256(flagged[i], _mm256_and_si256(v[i], one));
+        __m256i odd_mask = _mm256_cmpeq_epi64(odd, one);
+        __m256i higher = _mm256_and_si256(odd_mask, _mm256_cmpgt_epi64(v[i], h[i]));
+        h[i] = _mm256_blendv_epi8(h[i], v[i], higher);
+        // (3n + 1) / 2 in odd lanes, n / 2 in even ones, flagged lanes keep their value
+        __m256i half = _mm256_srli_epi64(v[i], 1);
+        __m256i next = _mm256_blendv_epi8(half, _mm256_add_epi64(_mm256_add_epi64(v[i], half), one), odd_mask);
+        v[i] = _mm256_blendv_epi8(next, v[i], flagged[i]);
+        s[i] = _mm256_add_epi64(s[i], _mm256_andnot_si256(flagged[i], _mm256_add_epi64(one, odd)));
+        flagged[i] = _mm256_or_si256(flagged[i], _mm256_or_si256(_mm256_cmpgt_epi64(t[i], v[i]), _mm256_cmpgt_epi64(v[i], limit)));
+      }
+    }
+    for(int i = 0; i < SWEEP_LANES / 4; i++) {
+      mask |= (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(flagged[i])) << (4 * i);
+    }
+  }
+  for(int i = 0; i < SWEEP_LANES / 4; i++) {
+    _mm256_store_si256((__m256i *)&value[4 * i], v[i]);
+    _mm256_store_si256((__m256i *)&steps[4 * i], s[i]);
+    _mm256_store_si256((__m256i *)&highest_odd[4 * i], h[i]);
+  }
+  return mask;
+}
+
+__attribute__((target("avx512f"))) static unsigned int sweep_step_avx512(int64_t *value, const int64_t *target, int64_t *steps,
+  int64_t *highest_odd) {
+  // the same with mask registers doing the selecting
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i limit = _mm512_set1_epi64(SWEEP_LANE_LIMIT);
+  __m512i v[SWEEP_LANES / 8], t[SWEEP_LANES / 8], s[SWEEP_LANES / 8], h[SWEEP_LANES / 8];
+  __mmask8 flagged[SWEEP_LANES / 8];
+  for(int i = 0; i < SWEEP_LANES / 8; i++) {
+    v[i] = _mm512_load_si512(&value[8 * i]);
+    t[i] = _mm512_load_si512(&target[8 * i]);
+    s[i] = _mm512_load_si512(&steps[8 * i]);
+    h[i] = _mm512_load_si512(&highest_odd[8 * i]);
+    flagged[i] = 0;
+  }
+  unsigned int mask = 0;
+  while(mask == 0) {
+    for(int round = 0; round < SWEEP_ROUNDS; round++) {
+      for(int i = 0; i < SWEEP_LANES / 8; i++) {
+        __mmask8 live = ~flagged[i];
+        __mmask8 odd = _mm512_mask_test_epi64_mask(live, v[i], one);
+        h[i] = _mm512_mask_max_epi64(h[i], odd, h[i], v[i]);
+        __m512i half = _mm512_srli_epi64(v[i], 1);
+        v[i] = _mm512_mask_mov_epi64(v[i], live & ~odd, half);
+        v[i] = _mm512_mask_add_epi64(v[i], odd, _mm512_add_epi64(v[i], half), one);
+        s[i] = _mm512_mask_add_epi64(s[i], live, s[i], one);
+        s[i] = _mm512_mask_add_epi64(s[i], odd, s[i], one);
+        flagged[i] |= _mm512_cmplt_epi64_mask(v[i], t[i]) | _mm512_cmpgt_epi64_mask(v[i], limit);
+      }
+    }
+    for(int i = 0; i < SWEEP_LANES / 8; i++) {
+      mask |= (unsigned int)flagged[i] << (8 * i);
+    }
+  }
+  for(int i = 0; i < SWEEP_LANES / 8; i++) {
+    _mm512_store_si512(&value[8 * i], v[i]);
+    _mm512_store_si512(&steps[8 * i], s[i]);
+    _mm512_store_si512(&highest_odd[8 * i], h[i]);
+  }
+  return mask;
+}
+
+static void sweep_work_lanes(sweep_worker *workers, int num_workers, int self, _Atomic uint16_t *memo, uint64_t memo_entries,
+  sweep_step_fn step) {
+  // sweep_work with SWEEP_LANES trajectories stepped together by a vector kernel, a lane whose trajectory is done
+  // (or needs the scalar code) gets the next starting value from our range
+  sweep_worker *worker = &workers[self];
+  _Alignas(64) int64_t value[SWEEP_LANES], target[SWEEP_LANES], steps[SWEEP_LANES], highest_odd[SWEEP_LANES];
+  uint64_t start[SWEEP_LANES];
+  uint64_t next = 0, end = 0; // what is left of the chunk we are working through
+  int active = 0;
+
+  for(int lane = 0; lane < SWEEP_LANES; lane++) {
+    value[lane] = 1; // an idle lane cycles between 1 and 2 and never gets flagged
+    target[lane] = 0;
+    steps[lane] = highest_odd[lane] = 0;
+  }
+  while(true) {
+    // give every idle lane the next starting value
+    for(int lane = 0; lane < SWEEP_LANES; lane++) {
+      while(target[lane] == 0 && (next < end || sweep_claim(workers, num_workers, self, &next, &end))) {
+        if(next == 1 || next > SWEEP_LANE_LIMIT) {
+          unsigned __int128 highest = 0;
+          int lane_steps = next == 1 ? 0 : sweep_stopping_time(next, next, 0, memo, memo_entries, &highest);
+          sweep_finish(worker, memo, memo_entries, next++, lane_steps, highest);
+          continue;
+        }
+        start[lane] = next;
+        value[lane] = next;
+        // past the memo table a trajectory is only worth stopping for once it drops into it
+        target[lane] = next < memo_entries ? next : memo_entries;
+        steps[lane] = highest_odd[lane] = 0;
+        next++;
+        active++;
+      }
+    }
+    if(active == 0) {
+      return; // no lane got any work
+    }
+
+    for(unsigned int flagged = step(value, target, steps, highest_odd); flagged != 0; flagged &= flagged - 1) {
+      int lane = __builtin_ctz(flagged);
+      unsigned __int128 lane_highest = highest_odd[lane];
+      int lane_steps = steps[lane];
+      if(value[lane] > SWEEP_LANE_LIMIT) {
+        lane_steps = sweep_stopping_time(start[lane], value[lane], lane_steps, memo, memo_entries, &lane_highest);
+      }
+      else if(value[lane] != 1) {
+        int known = (uint64_t)value[lane] < memo_entries ? atomic_load_explicit(&memo[value[lane]], memory_order_relaxed) : 0;
+        if(known == 0) {
+          target[lane] = value[lane]; // not known (yet), look again at the next new low
+          continue;
+        }
+        lane_steps += known;
+      }
+      sweep_finish(worker, memo, memo_entries, start[lane], lane_steps, lane_highest);
+      value[lane] = 1;
+      target[lane] = 0;
+      active--;
+    }
+  }
+}
+
+static void sweep_work_avx2(sweep_worker *workers, int num_workers, int self, _Atomic uint16_t *memo, uint64_t memo_entries) {
+  sweep_work_lanes(workers, num_workers, self, memo, memo_entries, sweep_step_avx2);
+}
+
+static void sweep_work_avx512(sweep_worker *workers, int num_workers, int self, _Atomic uint16_t *memo, uint64_t memo_entries) {
+  sweep_work_lanes(workers, num_workers, self, memo, memo_entries, sweep_step_avx512);
+}
+
+int collatz_sweep(uint64_t last, int num_workers) {
+  // find the stopping time of every starting value in [1, last] with num_workers processes
+  if(last == UINT64_MAX) {
+    fprintf(stderr, "Error: sweep must end below %" PRIu64 "\n", UINT64_MAX);
+    return 1;
+  }
+  // the workers and the memo table live in one shared mapping, untouched pages of the table cost nothing
+  uint64_t memo_entries = last + 1 < MEMO_ENTRIES ? last + 1 : MEMO_ENTRIES;
+  size_t workers_size = sizeof(sweep_worker) * num_workers;
+  size_t shared_size = workers_size + sizeof(_Atomic uint16_t) * memo_entries;
+  sweep_worker *workers = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(workers == MAP_FAILED) {
+    perror("mmap failure");
+    return 1;
+  }
+  _Atomic uint16_t *memo = (_Atomic uint16_t *)((char *)workers + workers_size); // zero means not known yet
+
+  // pick the kernel at run time, a binary built here still runs on a cpu without avx
+  __builtin_cpu_init();
+  if(kernel == KERNEL_BEST) {
+    kernel = __builtin_cpu_supports("avx512f") ? KERNEL_AVX512 : __builtin_cpu_supports("avx2") ? KERNEL_AVX2 : KERNEL_SCALAR;
+  }
+  if((kernel == KERNEL_AVX512 && !__builtin_cpu_supports("avx512f")) || (kernel == KERNEL_AVX2 && !__builtin_cpu_supports("avx2"))) {
+    fprintf(stderr, "Error: this cpu does not support the %s kernel\n", kernel == KERNEL_AVX2 ? "avx2" : "avx512");
+    munmap(workers, shared_size);
+    return 1;
+  }
+  void (*work)(sweep_worker *, int, int, _Atomic uint16_t *, uint64_t) =
+    kernel == KERNEL_AVX512 ? sweep_work_avx512 : kernel == KERNEL_AVX2 ? sweep_work_avx2 : sweep_work;
+
+  // split the range evenly to start with, stealing evens it out as some parts turn out slower than others
+  for(int i=0; i<num_workers; i++) {
+    atomic_flag_clear(&workers[i].lock);
+    workers[i].next = 1 + last / num_workers * i;
+    workers[i].end = i == num_workers - 1 ? last + 1 : 1 + last / num_workers * (i + 1);
+  }
+
+  uint64_t start = now_ns();
+  int started = 0;
+  for(; started<num_workers; started++) {
+    pid_t pid = fork();
+    if(pid < 0) {
+      perror("fork failure");
+      break; // the workers already running will steal the rest
+    }
+    if(pid == 0) {
+      place_child(started);
+      work(workers, num_workers, started, memo, memo_entries);
+      exit(0);
+    }
+  }
+  if(started == 0) {
+    munmap(workers, shared_size);
+    return 1;
+  }
+  int status;
+  for(int i=0; i<started; i++) {
+    wait(&status);
+  }
+  double seconds = (now_ns() - start) / 1e9;
+
+  // combine what the workers found
+  sweep_worker total = {0};
+  for(int i=0; i<num_workers; i++) {
+    sweep_worker *worker = &workers[i];
+    if(worker->longest_steps > total.longest_steps || (worker->longest_steps == total.longest_steps && worker->longest_start < total.longest_start)) {
+      total.longest_steps = worker->longest_steps;
+      total.longest_start = worker->longest_start;
+    }
+    if(worker->highest_odd > total.highest_odd || (worker->highest_odd == total.highest_odd && worker->highest_start < total.highest_start)) {
+      total.highest_odd = worker->highest_odd;
+      total.highest_start = worker->highest_start;
+    }
+    total.swept += worker->swept;
+    total.overflowed += worker->overflowed;
+    for(int j=0; j<HISTOGRAM_BUCKETS; j++) {
+      total.histogram[j] += worker->histogram[j];
+    }
+    if(!benchmark) {
+      printf("Worker %d Swept: %" PRIu64 " Steals: %d\n", i, worker->swept, worker->steals);
+    }
+  }
+
+  // the highest term of the whole range is either its last starting value or 3n + 1 for some odd term n
+  collatz_message highest = {0, 0, last, 0, 0};
+  unsigned __int128 highest_term = total.highest_odd * 3 + 1;
+  if(total.highest_odd > 0 && highest_term > last) {
+    highest.value = (uint64_t)highest_term;
+    highest.high = (uint64_t)(highest_term >> 64);
+  }
+  else {
+    total.highest_start = last;
+  }
+  char term[40];
+  static const char *kernel_names[] = {"scalar", "avx2", "avx512"};
+  printf("Sweep: 1 to %" PRIu64 " Workers: %d Kernel: %s Elapsed: %.6f s Starting values/sec: %.0f\n", last, started,
+    kernel_names[kernel], seconds, total.swept / seconds);
+  printf("Longest: %" PRIu64 " (%d steps) Highest term: %s (from %" PRIu64 ")\n", total.longest_start, total.longest_steps,
+    collatz_term_string(&highest, term), total.highest_start);
+  if(total.overflowed > 0) {
+    printf("Overflowed: %d\n", total.overflowed);
+  }
+  for(int j=0; j<HISTOGRAM_BUCKETS; j++) {
+    if(total.histogram[j] > 0) {
+      if(j == HISTOGRAM_BUCKETS - 1) {
+        printf("Stopping time %d+: %" PRIu64 "\n", j * HISTOGRAM_WIDTH, total.histogram[j]);
+      }
+      else {
+        printf("Stopping time %d-%d: %" PRIu64 "\n", j * HISTOGRAM_WIDTH, (j + 1) * HISTOGRAM_WIDTH - 1, total.histogram[j]);
+      }
+    }
+  }
+  munmap(workers, shared_size);
+  return started == num_workers ? 0 : 1;
+}
+
+int create_stats_page(int num_child_processes) {
+  // map the stats page before forking so every child can find its counters, in /dev/shm if -m named it
+  stats_size = sizeof(stats_page) + sizeof(child_stats) * num_child_processes;
+  if(stats_name[0] == '\0') {
+    stats = mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  }
+  else {
+    int shm_fd = shm_open(stats_name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if(shm_fd < 0) {
+      perror("shm_open failed");
+      return -1;
+    }
+    if(ftruncate(shm_fd, stats_size) < 0) {
+      perror("ftruncate failed");
+      close(shm_fd);
+      shm_unlink(stats_name);
+      return -1;
+    }
+    stats = mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd); // the mapping keeps the segment open
+    // from here on the segment goes away however we exit, an error on the way to the circle included
+    stats_owner = getpid();
+    atexit(unlink_stats_page);
+  }
+  if(stats == MAP_FAILED) {
+    perror("mmap failure");
+    stats = NULL;
+    unlink_stats_page();
+    return -1;
+  }
+  stats->num_children = num_child_processes;
+  atomic_store(&stats->running, 1);
+  return 0;
+}
+
+void unlink_stats_page() {
+  // remove the named stats segment once, children inherit the exit handler but the segment isn't theirs
+  if(stats_owner == getpid()) {
+    shm_unlink(stats_name);
+    stats_owner = 0;
+  }
+}
+
+void print_stats(const stats_page *page) {
+  // one line per child, a child still blocked counts as blocked up to now
+  uint64_t now = now_ns();
+  for(int i=0; i<page->num_children; i++) {
+    const child_stats *counters = &page->children[i];
+    uint64_t started = atomic_load_explicit(&counters->started_ns, memory_order_relaxed);
+    uint64_t stopped = atomic_load_explicit(&counters->stopped_ns, memory_order_relaxed);
+    uint64_t blocked = atomic_load_explicit(&counters->blocked_ns, memory_order_relaxed);
+    uint64_t since = atomic_load_explicit(&counters->blocked_since, memory_order_relaxed);
+    uint64_t end = stopped > 0 ? stopped : now;
+    if(since > 0 && stopped == 0 && since < end) {
+      blocked += end - since;
+    }
+    uint64_t alive = started > 0 && end > started ? end - started : 0;
+    if(blocked > alive) {
+      blocked = alive;
+    }
+    printf("Child %d PID: %d Messages: %" PRIu64 " In: %" PRIu64 " B Out: %" PRIu64 " B Blocked: %.3f s Computing: %.3f s"
+      " Queue: %u (max %u) Max latency: %" PRIu64 " ns\n", i, atomic_load_explicit(&counters->pid, memory_order_relaxed),
+      atomic_load_explicit(&counters->messages, memory_order_relaxed),
+      atomic_load_explicit(&counters->bytes_received, memory_order_relaxed),
+      atomic_load_explicit(&counters->bytes_sent, memory_order_relaxed), blocked / 1e9, (alive - blocked) / 1e9,
+      atomic_load_explicit(&counters->queue_depth, memory_order_relaxed),
+      atomic_load_explicit(&counters->max_queue_depth, memory_order_relaxed),
+      atomic_load_explicit(&counters->max_latency_ns, memory_order_relaxed));
+  }
+  fflush(stdout);
+}
+
+int watch_stats(const char *name) {
+  // print the stats page of a circle started with -m name every interval until it shuts down
+  int shm_fd = shm_open(name, O_RDONLY, 0);
+  if(shm_fd < 0) {
+    perror("shm_open failed");
+    return 1;
+  }
+  struct stat st;
+  if(fstat(shm_fd, &st) < 0 || st.st_size < (off_t)sizeof(stats_page)) {
+    fprintf(stderr, "Error: %s is not a stats page\n", name);
+    close(shm_fd);
+    return 1;
+  }
+  const stats_page *page = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  if(page == MAP_FAILED) {
+    perror("mmap failure");
+    return 1;
+  }
+  if(st.st_size < (off_t)(sizeof(stats_page) + sizeof(child_stats) * page->num_children)) {
+    fprintf(stderr, "Error: %s is not a stats page\n", name);
+    munmap((void *)page, st.st_size);
+    return 1;
+  }
+  int interval_ms = stats_interval_ms > 0 ? stats_interval_ms : 1000;
+  while(atomic_load(&page->running)) {
+    print_stats(page);
+    printf("\n");
+    usleep(interval_ms * 1000);
+  }
+  munmap((void *)page, st.st_size);
+  return 0;
+}
+
+int parse_cpu_list(const char *list) {
+  // cpus like 0-3,8,10-11 in the order given (the order child i takes them in with -a list)
+  const char *next = list;
+  free(placement_cpus);
+  placement_cpus = NULL;
+  num_placement_cpus = 0;
+  while(*next != '\0') {
+    char *end;
+    long first = strtol(next, &end, 10), last;
+    if(end == next) {
+      break;
+    }
+    last = first;
+    if(*end == '-') {
+      next = end + 1;
+      last = strtol(next, &end, 10);
+      if(end == next) {
+        break;
+      }
+    }
+    if(first < 0 || last < first || last >= CPU_SETSIZE) {
+      break;
+    }
+    int *grown = realloc(placement_cpus, sizeof(int) * (num_placement_cpus + last - first + 1));
+    if(grown == NULL) {
+      perror("memory allocation failure");
+      return -1;
+    }
+    placement_cpus = grown;
+    for(long cpu = first; cpu <= last; cpu++) {
+      placement_cpus[num_placement_cpus++] = cpu;
+    }
+    next = *end == ',' ? end + 1 : end;
+    if(*end != ',' && *end != '\0') {
+      break;
+    }
+  }
+  if(*next != '\0' || num_placement_cpus == 0) {
+    fprintf(stderr, "Error: %s is not a list of cpus like 0-3,8\n", list);
+    return -1;
+  }
+  return 0;
+}
+
+static int read_topology(int cpu, const char *file) {
+  // a number from the cpu's sysfs directory, -1 if it isn't there
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+  FILE *f = fopen(path, "r");
+  int value = -1;
+  if(f != NULL) {
+    if(fscanf(f, "%d", &value) != 1) {
+      value = -1;
+    }
+    fclose(f);
+  }
+  return value;
+}
+
+static int compare_place(const void *a, const void *b) {
+  // socket first, then (for PLACE_CACHE) the L3, then core, so neighbours end up as close as the policy asks
+  const cpu_place *x = a, *y = b;
+  if(x->package != y->package) {
+    return x->package - y->package;
+  }
+  if(placement == PLACE_CACHE && x->cache != y->cache) {
+    return x->cache - y->cache;
+  }
+  if(x->core != y->core) {
+    return x->core - y->core;
+  }
+  return x->cpu - y->cpu;
+}
+
+int plan_placement() {
+  // decide the cpu each child gets: the -c list (or every cpu we may run on), in order or sorted by topology
+  if(num_placement_cpus == 0) {
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+      perror("sched_getaffinity failure");
+      return -1;
+    }
+    placement_cpus = malloc(sizeof(int) * CPU_COUNT(&allowed));
+    if(placement_cpus == NULL) {
+      perror("memory allocation failure");
+      return -1;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if(CPU_ISSET(cpu, &allowed)) {
+        placement_cpus[num_placement_cpus++] = cpu;
+      }
+    }
+  }
+  if(placement == PLACE_LIST) {
+    return 0;
+  }
+  cpu_place *places = malloc(sizeof(cpu_place) * num_placement_cpus);
+  if(places == NULL) {
+    perror("memory allocation failure");
+    return -1;
+  }
+  for(int i=0; i<num_placement_cpus; i++) {
+    places[i].cpu = placement_cpus[i];
+    places[i].package = read_topology(places[i].cpu, "topology/physical_package_id");
+    places[i].cache = read_topology(places[i].cpu, "cache/index3/id");
+    places[i].core = read_topology(places[i].cpu, "topology/core_id");
+  }
+  qsort(places, num_placement_cpus, sizeof(cpu_place), compare_place);
+  for(int i=0; i<num_placement_cpus; i++) {
+    placement_cpus[i] = places[i].cpu;
+  }
+  free(places);
+  return 0;
+}
+
+int place_child(int index) {
+  // pin this child to its cpu, memory it touches from now on comes from that cpu's numa node
+  // returns the cpu, or -1 if the child stays unpinned
+  if(num_placement_cpus == 0) {
+    return -1;
+  }
+  int cpu = placement_cpus[index % num_placement_cpus];
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if(sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+    perror("sched_setaffinity failure"); // keep going unpinned
+    return -1;
+  }
+  return cpu;
+}
+
+
+static void* member_thread(void *arg) {
+  // body of a thread member, the same loop a child process runs
+  process_specific_information *ps_info = arg;
+  member_start(ps_info);
+  collatz_circle_loop(ps_info);
+  free(ps_info->send_batch);
+  free(ps_info->done_batch);
+  free(ps_info->receive_buffer);
+  return NULL;
+}
+
+int start_member_threads(int num_members, int window) {
+  // build the circle out of threads, member i reads ring i and writes ring i + 1 just like child i
+  thread_members = calloc(num_members, sizeof(process_specific_information));
+  member_reports = calloc(num_members, sizeof(member_report));
+  member_threads = malloc(sizeof(pthread_t) * num_members);
+  if(thread_members == NULL || member_reports == NULL || member_threads == NULL) {
+    perror("memory allocation failure");
+    free(thread_members);
+    free(member_reports);
+    free(member_threads);
+    return -1;
+  }
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, MEMBER_STACK_SIZE);
+  for(int i=0; i<num_members; i++) {
+    process_specific_information *member = &thread_members[i];
+    member->is_child_process = true;
+    member->wraps_around_circle = i == num_members - 1;
+    member->collatz_fd_read = member->collatz_fd_write = member->report_to_parent_fd_write = -1;
+    member->sequence_done_fd_write = sequence_done_pipe[WRITE];
+    member->ring_read = i;
+    member->ring_inject = i == 0 ? num_members : -1;
+    member->ring_write = (i + 1) % num_members;
+    member->report = &member_reports[i];
+    if(!allocate_batches(member, window)) {
+      pthread_attr_destroy(&attr);
+      return -1; // members already started go down with the process
+    }
+    int error = pthread_create(&member_threads[i], &attr, member_thread, member);
+    if(error != 0) {
+      fprintf(stderr, "thread creation failure: %s\n", strerror(error));
+      pthread_attr_destroy(&attr);
+      return -1;
+    }
+  }
+  pthread_attr_destroy(&attr);
+  return 0;
+}
+
+static void post_report(member_report *report, unsigned int state) {
+  atomic_store(&report->state, state); // publishes the tid and counts written before it
+  syscall(SYS_futex, &report->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void await_report(member_report *report, unsigned int state) {
+  unsigned int seen;
+  while((seen = atomic_load(&report->state)) < state) {
+    syscall(SYS_futex, &report->state, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0); // returns at once if state moved on
+  }
+}
+
+void report_ready(process_specific_information *ps_info, pid_t pid) {
+  // tell the parent this member is ready for messages and which cpu it got
+  if(ps_info->report != NULL) {
+    ps_info->report->tid = pid;
+    ps_info->report->cpu = ps_info->cpu;
+    post_report(ps_info->report, REPORT_READY);
+    return;
+  }
+  write(ps_info->report_to_parent_fd_write, &pid, sizeof(pid_t));
+  write(ps_info->report_to_parent_fd_write, &ps_info->cpu, sizeof(int));
+}
+
+void report_counts(process_specific_information *ps_info, pid_t pid, int even_numbers_received, int odd_numbers_received) {
+  // hand the parent this member's even & odd counts once the stop message has passed through it
+  if(ps_info->report != NULL) {
+    ps_info->report->even_numbers_received = even_numbers_received;
+    ps_info->report->odd_numbers_received = odd_numbers_received;
+    post_report(ps_info->report, REPORT_DONE);
+    return;
+  }
+  write(ps_info->report_to_parent_fd_write, &pid, sizeof(pid_t));
+  write(ps_info->report_to_parent_fd_write, &even_numbers_received, sizeof(int));
+  write(ps_info->report_to_parent_fd_write, &odd_numbers_received, sizeof(int));
+  close(ps_info->report_to_parent_fd_write); // close the pipe to write to the parent
+}
+
+pid_t await_ready(int index, int **report_to_parent_pipe_array, int *cpu) {
+  // wait for member index's ready message, returns its pid (thread id for thread members) and the cpu it is pinned to
+  pid_t pid;
+  if(members == MEMBER_THREAD) {
+    await_report(&member_reports[index], REPORT_READY);
+    *cpu = member_reports[index].cpu;
+    return member_reports[index].tid;
+  }
+  read(report_to_parent_pipe_array[index][READ], &pid, sizeof(pid_t));
+  read(report_to_parent_pipe_array[index][READ], cpu, sizeof(int));
+  return pid;
+}
+
+pid_t await_counts(int index, int **report_to_parent_pipe_array, int *even_numbers_received, int *odd_numbers_received) {
+  // wait for member index's even & odd counts, returns its pid (thread id for thread members)
+  pid_t pid;
+  if(members == MEMBER_THREAD) {
+    await_report(&member_reports[index], REPORT_DONE);
+    *even_numbers_received = member_reports[index].even_numbers_received;
+    *odd_numbers_received = member_reports[index].odd_numbers_received;
+    return member_reports[index].tid;
+  }
+  read(report_to_parent_pipe_array[index][READ], &pid, sizeof(pid_t));
+  read(report_to_parent_pipe_array[index][READ], even_numbers_received, sizeof(int));
+  read(report_to_parent_pipe_array[index][READ], odd_numbers_received, sizeof(int));
+  close(report_to_parent_pipe_array[index][READ]); // close the read end for the pipe
+  return pid;
 }
\ No newline at end of file
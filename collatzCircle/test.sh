@@ -0,0 +1,31 @@
+#!/bin/sh
+# Checks the collatz circle against known totals: the stopping times of 1 to 10000 add up to 859666 terms whatever
+# the members, transport or window, and a circle too big for the default window still runs without -w.
+#
+# usage: ./test.sh (exits non zero on the first failure)
+
+dir=$(cd "$(dirname "$0")" && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+
+${CC:-gcc} -O2 -pthread -o "$bin/collatz_circle" "$dir/collatz_circle.c" || exit 1
+
+# expect <pattern> <collatz_circle arguments>: the run succeeds and its summary matches the pattern
+expect() {
+  pattern=$1
+  shift
+  if ! summary=$("$bin/collatz_circle" "$@" | grep '^Members:') || ! echo "$summary" | grep -q "$pattern"; then
+    echo "FAIL: collatz_circle $* (${summary:-no summary})"
+    exit 1
+  fi
+  echo "ok: collatz_circle $*"
+}
+
+expect 'Terms: 859666 Longest: 6171 (261 steps)' -b 10000 4
+expect 'Terms: 859666 Longest: 6171 (261 steps)' -w 16 -b 10000 4
+expect 'Terms: 859666 Longest: 6171 (261 steps)' -t futex -w 16 -b 10000 8
+expect 'Terms: 859666 Longest: 6171 (261 steps)' -e thread -t eventfd -w 16 -b 10000 8
+# twice the members is more than a pipe's or a ring's window, the default is cut down to fit
+expect 'Window: 170 Sequences: 999 Terms: 60430' -r 1:1000 100
+expect 'Window: 128 Sequences: 999 Terms: 60430' -m collatz_test -r 1:1000 100
+expect 'Sequences: 999 Terms: 60430' -e thread -r 1:1000 1024
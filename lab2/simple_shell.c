@@ -4,76 +4,807 @@ Course: Operating Systems - Section 1
 Objective: Create a Simple Shell Program
 */
 
+#define _GNU_SOURCE // pipe2
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <unistd.h>
 
-// necessary define for determining acceptible input size
+// lines can be any length, this is only how much of one the prompt, job list and stats keep
 #define MAX_INPUT_SIZE 100
-#define MAX_TOKENS (MAX_INPUT_SIZE + 1)
+// most commands in one pipeline
+#define MAX_STAGES 64
+// bytes a script that isn't a regular file (or the terminal) is read in at a time
+#define READ_CHUNK (64 * 1024)
+// background jobs plus commands started by parallel that can be running at once
+#define MAX_JOBS 64
 
-int main() {
+// the ways a command can be launched
+typedef enum {
+  LAUNCH_SPAWN, // posix_spawnp(), glibc starts the child with clone(CLONE_VM|CLONE_VFORK) so no page tables are copied
+  LAUNCH_FORK   // fork() then execvp(), copies the shell's page tables on every command
+} launcher_kind;
+
+// how long the shell spent launching commands with one launcher (spawnstat built-in)
+typedef struct {
+  long launches;
+  long total_ns;
+  long min_ns;
+  long max_ns;
+} launch_stats;
+
+// what one command line used, summed over the stages of its pipeline as wait4() reaps them
+typedef struct {
+  struct timeval utime; // user CPU time
+  struct timeval stime; // system CPU time
+  long max_rss_kb; // the largest stage's peak resident set
+  long minor_faults;
+  long major_faults;
+  long voluntary_switches;
+  long involuntary_switches;
+  long wall_ns; // from launch until the last stage was reaped
+} command_usage;
+
+// every command line run so far (stats built-in)
+typedef struct {
+  long commands;
+  command_usage total; // max_rss_kb is the peak of any command
+  long max_wall_ns;
+  char slowest[MAX_INPUT_SIZE];
+} usage_totals;
+
+// a background job or a command started by the parallel built-in, with every stage of its pipeline
+typedef struct {
+  bool in_use;
+  bool quiet; // started by parallel, which collects it itself instead of reporting it at the prompt
+  pid_t pids[MAX_STAGES]; // 0 once reaped
+  int stage_count;
+  int running; // stages not reaped yet
+  int status; // wait status of the last stage, like for a foreground command
+  char command[MAX_INPUT_SIZE];
+  struct timespec started;
+  command_usage usage;
+} job;
+
+extern char **environ;
+static sigset_t child_sigmask; // the signal mask commands start with (the shell itself blocks SIGCHLD for its signalfd)
+static usage_totals command_totals;
+static FILE *stats_log = NULL; // statslog built-in: one csv row per command line
+
+// reads commands a line at a time, a regular file is mapped whole and anything else is read in big chunks
+typedef struct {
+  int fd;
+  char *data;
+  size_t size; // bytes in data
+  size_t capacity; // bytes data has room for (unused when mapped)
+  size_t next; // where the next line starts
+  bool mapped;
+  bool eof;
+} line_reader;
+
+// where a line is copied and tokenized, grown to fit the longest line so far and reused for every line after it
+typedef struct {
+  char *line; // the line, NUL terminated
+  char *text; // the text of its tokens (two bytes per character of the line is always enough)
+  char **tokens; // NULL terminated, a line of n characters has at most n tokens
+  size_t capacity; // longest line it has room for
+} token_arena;
+
+// one command of a pipeline, with where its input comes from and its output goes if not the pipes
+typedef struct {
+  char **argv; // points into the tokens, NULL terminated
+  char *input_file; // < file (NULL if none)
+  char *output_file; // > file or >> file (NULL if none)
+  bool append; // >>
+} pipeline_stage;
+
+static long elapsed_ns(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+static int tokenize(const char *line, char *buffer, char **tokens);
+
+static bool open_reader(line_reader *reader, int fd, bool may_map) {
+  // map a regular file whole (no copy, no read per line), otherwise get a buffer for reading it in chunks
+  // (a mapping never moves the file offset, so only files no command inherits may be mapped)
+  struct stat info;
+  *reader = (line_reader){.fd = fd};
+  if (may_map && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    reader->data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (reader->data != MAP_FAILED) {
+      madvise(reader->data, info.st_size, MADV_SEQUENTIAL);
+      reader->size = info.st_size;
+      reader->mapped = true;
+      reader->eof = true; // everything is already there
+      return true;
+    }
+  }
+  reader->capacity = READ_CHUNK;
+  if ((reader->data = malloc(reader->capacity)) == NULL) {
+    perror("malloc failure");
+    return false;
+  }
+  return true;
+}
+
+// hand the bytes read past the current line back to a seekable input, so a command reading the shell's stdin
+// starts right after its own line and the shell carries on from wherever the command left off
+static void unread_input(line_reader *reader) {
+  if (reader->mapped || reader->next == reader->size) {
+    return;
+  }
+  if (lseek(reader->fd, -(off_t)(reader->size - reader->next), SEEK_CUR) >= 0) {
+    reader->size = reader->next;
+    reader->eof = false;
+  }
+}
+
+// the next line (without its newline) and its length, NULL at the end of the input
+static const char* next_line(line_reader *reader, size_t *length) {
+  while (true) {
+    const char *start = reader->data + reader->next;
+    const char *newline = memchr(start, '\n', reader->size - reader->next);
+    if (newline != NULL) {
+      *length = newline - start;
+      reader->next += *length + 1;
+      return start;
+    }
+    if (reader->eof) {
+      // the last line may not end in a newline
+      if (reader->next == reader->size) {
+        return NULL;
+      }
+      *length = reader->size - reader->next;
+      reader->next = reader->size;
+      return start;
+    }
+    // move the partial line to the front and read more after it, growing the buffer for a line longer than it
+    memmove(reader->data, start, reader->size - reader->next);
+    reader->size -= reader->next;
+    reader->next = 0;
+    if (reader->size == reader->capacity) {
+      char *grown = realloc(reader->data, reader->capacity * 2);
+      if (grown == NULL) {
+        perror("malloc failure");
+        reader->eof = true;
+        continue;
+      }
+      reader->data = grown;
+      reader->capacity *= 2;
+    }
+    ssize_t bytes = read(reader->fd, reader->data + reader->size, reader->capacity - reader->size);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes < 0) {
+      perror("read failure");
+    }
+    if (bytes <= 0) {
+      reader->eof = true;
+      continue;
+    }
+    reader->size += bytes;
+  }
+}
+
+static void close_reader(line_reader *reader) {
+  if (reader->mapped) {
+    munmap(reader->data, reader->size);
+  }
+  else {
+    free(reader->data);
+  }
+  if (reader->fd != STDIN_FILENO) {
+    close(reader->fd);
+  }
+}
+
+// copy a line into the arena (growing it only for a line longer than any before) and tokenize it there,
+// returns the number of tokens or -1 if the arena could not grow
+static int arena_tokenize(token_arena *arena, const char *line, size_t length) {
+  if (arena->line == NULL || length > arena->capacity) {
+    size_t capacity = 2 * arena->capacity > MAX_INPUT_SIZE ? 2 * arena->capacity : MAX_INPUT_SIZE;
+    if (length > capacity) {
+      capacity = length;
+    }
+    char *grown_line = realloc(arena->line, capacity + 1);
+    if (grown_line != NULL) {
+      arena->line = grown_line;
+    }
+    char *grown_text = realloc(arena->text, 2 * capacity + 1);
+    if (grown_text != NULL) {
+      arena->text = grown_text;
+    }
+    char **grown_tokens = realloc(arena->tokens, sizeof(char *) * (capacity + 1));
+    if (grown_tokens != NULL) {
+      arena->tokens = grown_tokens;
+    }
+    if (grown_line == NULL || grown_text == NULL || grown_tokens == NULL) {
+      perror("malloc failure");
+      return -1;
+    }
+    arena->capacity = capacity;
+  }
+  memcpy(arena->line, line, length);
+  arena->line[length] = '\0';
+  return tokenize(arena->line, arena->text, arena->tokens);
+}
+
+static bool is_operator(const char *token) {
+  return strcmp(token, "|") == 0 || strcmp(token, "<") == 0 || strcmp(token, ">") == 0 || strcmp(token, ">>") == 0 ||
+    strcmp(token, "&") == 0;
+}
+
+// split a line into tokens, | < > >> and & are tokens of their own even without spaces around them,
+// the text of the tokens goes in buffer (two bytes per character of the line is always enough)
+static int tokenize(const char *line, char *buffer, char **tokens) {
+  int count = 0;
+  while (*line != '\0') {
+    if (*line == ' ' || *line == '\t' || *line == '\n') {
+      line++;
+      continue;
+    }
+    tokens[count++] = buffer;
+    if (*line == '|' || *line == '<' || *line == '>' || *line == '&') {
+      if (line[0] == '>' && line[1] == '>') {
+        *buffer++ = *line++;
+      }
+      *buffer++ = *line++;
+    }
+    else {
+      while (*line != '\0' && strchr(" \t\n|<>&", *line) == NULL) {
+        *buffer++ = *line++;
+      }
+    }
+    *buffer++ = '\0';
+  }
+  tokens[count] = NULL;
+  return count;
+}
+
+// split the tokens at each | into the stages of a pipeline and take the redirections out of their argv,
+// returns the number of stages or -1 if the line is not a valid pipeline
+static int parse_pipeline(char **tokens, pipeline_stage *stages) {
+  int count = 0;
+  int kept = 0; // the argvs are compacted in place, redirections take up two tokens and leave none behind
+  stages[0] = (pipeline_stage){tokens, NULL, NULL, false};
+  for (int i = 0; tokens[i] != NULL; i++) {
+    if (strcmp(tokens[i], "|") == 0) {
+      if (&tokens[kept] == stages[count].argv) {
+        printf("syntax error: empty command in pipeline\n");
+        return -1;
+      }
+      if (count == MAX_STAGES - 1) {
+        printf("syntax error: more than %d commands in pipeline\n", MAX_STAGES);
+        return -1;
+      }
+      tokens[kept++] = NULL;
+      stages[++count] = (pipeline_stage){&tokens[kept], NULL, NULL, false};
+    }
+    else if (strcmp(tokens[i], "&") == 0) {
+      // a trailing & was already taken off the line, so this one is either the whole line or came before more tokens
+      if (i == 0 && tokens[1] == NULL) {
+        printf("syntax error: & needs a command to run in the background\n");
+      }
+      else {
+        printf("syntax error: & is only allowed as the last token of a command line\n");
+      }
+      return -1;
+    }
+    else if (is_operator(tokens[i])) {
+      if (tokens[i + 1] == NULL || is_operator(tokens[i + 1])) {
+        printf("syntax error: %s needs a file name\n", tokens[i]);
+        return -1;
+      }
+      if (tokens[i][0] == '<') {
+        stages[count].input_file = tokens[i + 1];
+      }
+      else {
+        stages[count].output_file = tokens[i + 1];
+        stages[count].append = tokens[i][1] == '>';
+      }
+      i++;
+    }
+    else {
+      tokens[kept++] = tokens[i];
+    }
+  }
+  if (&tokens[kept] == stages[count].argv) {
+    printf("syntax error: empty command in pipeline\n");
+    return -1;
+  }
+  tokens[kept] = NULL;
+  return count + 1;
+}
+
+static void close_unless_standard(int fd) {
+  if (fd > STDERR_FILENO) {
+    close(fd);
+  }
+}
+
+static void record_launch(launch_stats *timing, const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long latency_ns = elapsed_ns(start, &end);
+  if (timing->launches == 0 || latency_ns < timing->min_ns) {
+    timing->min_ns = latency_ns;
+  }
+  if (latency_ns > timing->max_ns) {
+    timing->max_ns = latency_ns;
+  }
+  timing->total_ns += latency_ns;
+  timing->launches++;
+}
+
+// start a command reading input_fd and writing output_fd, returns its pid,
+// 0 if posix_spawnp could not find or run the command (already reported) or -1 if no process could be created
+static pid_t launch_command(char **argv, int input_fd, int output_fd, launcher_kind launcher, launch_stats *timings) {
+  pid_t pid;
+  struct timespec launch_start; // launch latency is the time until the command has been exec'd
+  int exec_pipe[2]; // fork: closed by a successful exec, so both launchers are timed up to the exec
+
+  fflush(stdout); // a forked child would otherwise write out our buffered output again
+  clock_gettime(CLOCK_MONOTONIC, &launch_start);
+  if (launcher == LAUNCH_SPAWN) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (input_fd != STDIN_FILENO) {
+      posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    }
+    if (output_fd != STDOUT_FILENO) {
+      posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    }
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &child_sigmask);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    int error = posix_spawnp(&pid, argv[0], &actions, &attributes, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (error == 0) {
+      record_launch(&timings[LAUNCH_SPAWN], &launch_start);
+      return pid;
+    }
+    errno = error;
+    if (error == ENOENT || error == EACCES || error == ENOEXEC || error == ENOTDIR) {
+      // posix_spawnp reports a failed exec itself
+      perror("Unknown command");
+      return 0;
+    }
+    perror("posix_spawnp failure, falling back to fork");
+  }
+
+  // fork a new process and ensure it succceded
+  if (pipe2(exec_pipe, O_CLOEXEC) < 0) {
+    perror("pipe failure");
+    return -1;
+  }
+  if ((pid = fork()) < 0) {
+    close(exec_pipe[0]);
+    close(exec_pipe[1]);
+    perror("fork failure");
+    return -1;
+  }
+  // the child calls execvp() to run the command and exit()
+  else if (pid == 0) {
+    close(exec_pipe[0]);
+    sigprocmask(SIG_SETMASK, &child_sigmask, NULL);
+    if (input_fd != STDIN_FILENO) {
+      dup2(input_fd, STDIN_FILENO);
+    }
+    if (output_fd != STDOUT_FILENO) {
+      dup2(output_fd, STDOUT_FILENO);
+    }
+    // exit the process if an unknown command was entered
+    execvp(argv[0], argv);
+    perror("Unknown command");
+    exit(2);
+  }
+  // wait for the exec (or the child's exit) to close the other end
+  char byte;
+  close(exec_pipe[1]);
+  read(exec_pipe[0], &byte, 1);
+  close(exec_pipe[0]);
+  record_launch(&timings[LAUNCH_FORK], &launch_start);
+  return pid;
+}
+
+// start every stage of a pipeline before waiting for any, so they all run at once with the pipes between them,
+// returns how many stages started (their pids are in pids) or -1 if the shell could not create a pipe or process
+static int launch_pipeline(pipeline_stage *stages, int stage_count, pid_t *pids, launcher_kind launcher, launch_stats *timings,
+  int *unknown_commands_count) {
+  int launched = 0;
+  int input_fd = STDIN_FILENO; // what the next stage reads, the previous stage's pipe after the first
+
+  for (int i = 0; i < stage_count; i++) {
+    int output_fd = STDOUT_FILENO;
+    int next_input_fd = STDIN_FILENO;
+    bool redirect_failed = false;
+
+    // every descriptor the shell opens is close-on-exec, a stage only keeps the two it is given as stdin and stdout
+    if (i < stage_count - 1) {
+      int pipe_fds[2];
+      if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        perror("pipe failure");
+        close_unless_standard(input_fd);
+        return -1;
+      }
+      output_fd = pipe_fds[1];
+      next_input_fd = pipe_fds[0];
+    }
+    // a redirection takes the place of the pipe on that side (the neighbouring stage then sees end of file)
+    if (stages[i].input_file != NULL) {
+      close_unless_standard(input_fd);
+      if ((input_fd = open(stages[i].input_file, O_RDONLY | O_CLOEXEC)) < 0) {
+        perror(stages[i].input_file);
+        redirect_failed = true;
+      }
+    }
+    if (stages[i].output_file != NULL) {
+      close_unless_standard(output_fd);
+      int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (stages[i].append ? O_APPEND : O_TRUNC);
+      if ((output_fd = open(stages[i].output_file, flags, 0666)) < 0) {
+        perror(stages[i].output_file);
+        redirect_failed = true;
+      }
+    }
+
+    if (!redirect_failed) {
+      pid_t pid = launch_command(stages[i].argv, input_fd, output_fd, launcher, timings);
+      if (pid < 0) {
+        close_unless_standard(input_fd);
+        close_unless_standard(output_fd);
+        close_unless_standard(next_input_fd);
+        return -1;
+      }
+      else if (pid == 0) {
+        (*unknown_commands_count)++; // posix_spawnp found no such command, no child is left to exit with status 2
+      }
+      else {
+        pids[launched++] = pid;
+      }
+    }
+    // the stage has its own copies now
+    close_unless_standard(input_fd);
+    close_unless_standard(output_fd);
+    input_fd = next_input_fd;
+  }
+  return launched;
+}
+
+static void add_usage(command_usage *total, const struct rusage *usage) {
+  // add one reaped stage's usage (timeradd borrows when the microseconds wrap)
+  timeradd(&total->utime, &usage->ru_utime, &total->utime);
+  timeradd(&total->stime, &usage->ru_stime, &total->stime);
+  if (usage->ru_maxrss > total->max_rss_kb) {
+    total->max_rss_kb = usage->ru_maxrss;
+  }
+  total->minor_faults += usage->ru_minflt;
+  total->major_faults += usage->ru_majflt;
+  total->voluntary_switches += usage->ru_nvcsw;
+  total->involuntary_switches += usage->ru_nivcsw;
+}
+
+static void record_command(const char *command, int status, command_usage *usage, const struct timespec *started) {
+  // account for a command line whose stages have all been reaped, and log it if statslog is on
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  usage->wall_ns = elapsed_ns(started, &now);
+
+  command_usage *total = &command_totals.total;
+  command_totals.commands++;
+  timeradd(&total->utime, &usage->utime, &total->utime);
+  timeradd(&total->stime, &usage->stime, &total->stime);
+  if (usage->max_rss_kb > total->max_rss_kb) {
+    total->max_rss_kb = usage->max_rss_kb;
+  }
+  total->minor_faults += usage->minor_faults;
+  total->major_faults += usage->major_faults;
+  total->voluntary_switches += usage->voluntary_switches;
+  total->involuntary_switches += usage->involuntary_switches;
+  total->wall_ns += usage->wall_ns;
+  if (usage->wall_ns > command_totals.max_wall_ns) {
+    command_totals.max_wall_ns = usage->wall_ns;
+    snprintf(command_totals.slowest, MAX_INPUT_SIZE, "%.*s", (int)strcspn(command, "\n"), command);
+  }
+
+  if (stats_log != NULL) {
+    // quote the command line, doubling any quotes in it
+    fputc('"', stats_log);
+    for (const char *c = command; *c != '\0' && *c != '\n'; c++) {
+      if (*c == '"') {
+        fputc('"', stats_log);
+      }
+      fputc(*c, stats_log);
+    }
+    fprintf(stats_log, "\",%d,%.6f,%ld.%06ld,%ld.%06ld,%ld,%ld,%ld,%ld,%ld\n",
+      WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status), usage->wall_ns / 1e9,
+      (long)usage->utime.tv_sec, (long)usage->utime.tv_usec, (long)usage->stime.tv_sec, (long)usage->stime.tv_usec,
+      usage->max_rss_kb, usage->minor_faults, usage->major_faults, usage->voluntary_switches, usage->involuntary_switches);
+    fflush(stats_log);
+  }
+}
+
+static job* add_job(job *jobs, const char *command, bool quiet) {
+  // take a free slot in the job table, NULL if every one is in use
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (!jobs[i].in_use) {
+      jobs[i] = (job){.in_use = true, .quiet = quiet};
+      clock_gettime(CLOCK_MONOTONIC, &jobs[i].started);
+      snprintf(jobs[i].command, MAX_INPUT_SIZE, "%.*s", (int)strcspn(command, "\n"), command);
+      return &jobs[i];
+    }
+  }
+  return NULL;
+}
+
+// reap every job stage that has exited, without blocking
+static void reap_jobs(job *jobs, int *unknown_commands_count) {
+  pid_t pid;
+  int status;
+  struct rusage usage;
+  // foreground commands are waited for by pid before the shell gets here again, so every child reaped is a job's
+  while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+      for (int j = 0; jobs[i].in_use && j < jobs[i].stage_count; j++) {
+        if (jobs[i].pids[j] != pid) {
+          continue;
+        }
+        jobs[i].pids[j] = 0;
+        jobs[i].running--;
+        add_usage(&jobs[i].usage, &usage);
+        if (j == jobs[i].stage_count - 1) {
+          jobs[i].status = status;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 2) {
+          (*unknown_commands_count)++;
+        }
+        if (jobs[i].running == 0) {
+          record_command(jobs[i].command, jobs[i].status, &jobs[i].usage, &jobs[i].started);
+        }
+      }
+    }
+  }
+}
+
+static void wait_for_sigchld(int sigchld_fd) {
+  // block until a child changes state (SIGCHLD stays pending for the signalfd, so none is missed between reaps)
+  struct signalfd_siginfo info;
+  if (read(sigchld_fd, &info, sizeof(info)) < 0 && errno != EINTR) {
+    perror("signalfd read failure");
+  }
+}
+
+static void report_finished_jobs(job *jobs) {
+  // tell the user about background jobs that finished since the last prompt and free their slots
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (!jobs[i].in_use || jobs[i].quiet || jobs[i].running > 0) {
+      continue;
+    }
+    if (WIFEXITED(jobs[i].status) && WEXITSTATUS(jobs[i].status) == 0) {
+      printf("[%d] Done %s\n", i + 1, jobs[i].command);
+    }
+    else if (WIFEXITED(jobs[i].status)) {
+      printf("[%d] Exit %d %s\n", i + 1, WEXITSTATUS(jobs[i].status), jobs[i].command);
+    }
+    else {
+      printf("[%d] Killed by signal %d %s\n", i + 1, WTERMSIG(jobs[i].status), jobs[i].command);
+    }
+    jobs[i].in_use = false;
+  }
+}
+
+static void wait_for_jobs(job *jobs, int id, int sigchld_fd, int *unknown_commands_count) {
+  // wait built-in: block until background job id (every background job if id is 0) has finished
+  while (true) {
+    reap_jobs(jobs, unknown_commands_count);
+    bool waiting = false;
+    for (int i = 0; i < MAX_JOBS; i++) {
+      if (jobs[i].in_use && !jobs[i].quiet && jobs[i].running > 0 && (id == 0 || id == i + 1)) {
+        waiting = true;
+      }
+    }
+    if (!waiting) {
+      return;
+    }
+    wait_for_sigchld(sigchld_fd);
+  }
+}
+
+// parallel built-in: run every line of a file as a command line (pipelines and redirections too) with at most
+// max_running of them at once, returns -1 if the shell could not create a pipe or process
+static int run_parallel(const char *path, int max_running, job *jobs, int sigchld_fd, launcher_kind launcher,
+  launch_stats *timings, int *unknown_commands_count) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  line_reader commands;
+  if (fd < 0) {
+    perror(path);
+    return 0;
+  }
+  if (!open_reader(&commands, fd, true)) {
+    close(fd);
+    return 0;
+  }
+  token_arena arena = {NULL, NULL, NULL, 0};
+  pipeline_stage stages[MAX_STAGES];
+  int running = 0, started = 0, failed = 0;
+  bool more = true;
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (more || running > 0) {
+    reap_jobs(jobs, unknown_commands_count);
+    report_finished_jobs(jobs); // background jobs finishing meanwhile give their slots back
+    for (int i = 0; i < MAX_JOBS; i++) {
+      if (jobs[i].in_use && jobs[i].quiet && jobs[i].running == 0) {
+        if (!WIFEXITED(jobs[i].status) || WEXITSTATUS(jobs[i].status) != 0) {
+          failed++;
+        }
+        jobs[i].in_use = false;
+        running--;
+      }
+    }
+
+    // start the next command whenever one of the max_running places (and a job slot) is free
+    job *slot;
+    if (more && running < max_running && (slot = add_job(jobs, "", true)) != NULL) {
+      size_t length;
+      const char *line = next_line(&commands, &length);
+      if (line == NULL) {
+        slot->in_use = false;
+        more = false;
+        continue;
+      }
+      int stage_count;
+      if (arena_tokenize(&arena, line, length) <= 0 || (stage_count = parse_pipeline(arena.tokens, stages)) < 0) {
+        slot->in_use = false; // blank lines are skipped, bad ones have been reported
+        continue;
+      }
+      snprintf(slot->command, MAX_INPUT_SIZE, "%s", arena.line);
+      int launched = launch_pipeline(stages, stage_count, slot->pids, launcher, timings, unknown_commands_count);
+      if (launched < 0) {
+        close_reader(&commands);
+        free(arena.line);
+        free(arena.text);
+        free(arena.tokens);
+        return -1;
+      }
+      started++;
+      if (launched == 0) {
+        slot->in_use = false;
+        failed++;
+        continue;
+      }
+      slot->stage_count = slot->running = launched;
+      running++;
+      continue;
+    }
+    if (more || running > 0) {
+      wait_for_sigchld(sigchld_fd);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  close_reader(&commands);
+  free(arena.line);
+  free(arena.text);
+  free(arena.tokens);
+  printf("parallel: %d commands, %d failed, %.3f seconds\n", started, failed, elapsed_ns(&start, &end) / 1e9);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
   // cumulative variables that shouldn't reset each iteration of the loop
   int unknown_commands_count = 0; // the total number of unrecognized commands
-  long total_children_nivcsw = 0; // the total number of invoulantary context switches (for all children)
-  struct timeval total_children_utime = {.tv_sec = 0, .tv_usec = 0}; // the total user CPU time used
+  int script_fd = STDIN_FILENO; // where commands come from (-f script)
+  int opt;
+  line_reader input; // reads the commands
+  token_arena arena = {NULL, NULL, NULL, 0}; // every line is tokenized here, no allocation per line
   char * prompt = malloc(sizeof(char) * MAX_INPUT_SIZE); // the prompt used (for extra credit)
+  launcher_kind launcher = LAUNCH_SPAWN; // fork is kept as a fallback (launcher built-in)
+  launch_stats launch_timings[2] = {{0, 0, 0, 0}, {0, 0, 0, 0}}; // indexed by launcher
+  static const char *launcher_names[] = {"spawn", "fork"};
+  job jobs[MAX_JOBS]; // background jobs and commands started by parallel
+  sigset_t sigchld_set;
+  int sigchld_fd; // readable whenever a child has exited
   
   strcpy(prompt, "Enter desired command:"); // the default prompt
+  memset(jobs, 0, sizeof(jobs));
+
+  // -f runs a script of commands, so does input that isn't a terminal (both without prompting)
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    if (opt == 'f' && (script_fd = open(optarg, O_RDONLY | O_CLOEXEC)) < 0) {
+      perror(optarg);
+      free(prompt);
+      exit(1);
+    }
+    else if (opt != 'f') {
+      fprintf(stderr, "Usage: %s [-f script]\n", argv[0]);
+      free(prompt);
+      exit(1);
+    }
+  }
+  bool interactive = script_fd == STDIN_FILENO && isatty(STDIN_FILENO);
+  // commands inherit stdin, so it is read rather than mapped (-f scripts are close on exec)
+  if (!open_reader(&input, script_fd, script_fd != STDIN_FILENO)) {
+    free(prompt);
+    exit(1);
+  }
+
+  // take SIGCHLD through a signalfd, so the shell waits for whichever job finishes first instead of one at a time
+  sigemptyset(&sigchld_set);
+  sigaddset(&sigchld_set, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &sigchld_set, &child_sigmask) < 0 || (sigchld_fd = signalfd(-1, &sigchld_set, SFD_CLOEXEC)) < 0) {
+    free(prompt);
+    perror("signalfd failure");
+    exit(1);
+  }
 
   while (true) {
-      int token_count = 0; // a count of how many tokens the string was broken into
-      char *user_input = malloc(sizeof(char) * MAX_INPUT_SIZE); // used to store user input
-      char **user_tokens = malloc(sizeof(char *) * MAX_TOKENS); // used to store tokens
+      // report the background jobs that have finished since the last prompt
+      reap_jobs(jobs, &unknown_commands_count);
+      report_finished_jobs(jobs);
 
-      // ensure malloc did not fail
-      if (user_input == NULL || user_tokens == NULL) {
-        perror("malloc failure");
-        exit(1);
+      // prompt user for command and get input (the end of the input quits)
+      if (interactive) {
+        printf("%s ", prompt);
+        fflush(stdout);
+      }
+      size_t length;
+      const char *line = next_line(&input, &length);
+      if (line == NULL) {
+        break;
       }
 
-      // prompt user for command and get input
-      printf("%s ", prompt);
-      fgets(user_input, MAX_INPUT_SIZE, stdin);
-
-      // prompt again for input if nothing was entered (not counted in unknown commands total)
-      if (user_input[0] == '\n' || user_input[0] == ' ') {
-          free(user_input);
-          free(user_tokens);
+      // parse the command into tokens (NULL terminated for the execvp() call), blank lines are skipped
+      // (not counted in unknown commands total)
+      int token_count = arena_tokenize(&arena, line, length);
+      if (token_count <= 0) {
           continue;
       }
-
-      // parse the command into tokens
-      char * tok = strtok(user_input, " \n");
-      while(tok != NULL && token_count < MAX_TOKENS - 1) {
-        user_tokens[token_count++] = tok;
-        tok = strtok(NULL, " \n");
+      char *user_input = arena.line;
+      char **user_tokens = arena.tokens;
+      // a trailing & runs the command in the background
+      bool background = token_count > 1 && strcmp(user_tokens[token_count - 1], "&") == 0;
+      if (background) {
+        user_tokens[--token_count] = NULL;
+        // and is left out of the command line the job is named after (the & is the line's last non-blank character)
+        size_t end = strlen(user_input);
+        while (strchr(" \t\n", user_input[end - 1]) != NULL) {
+          end--;
+        }
+        end--;
+        while (end > 0 && strchr(" \t\n", user_input[end - 1]) != NULL) {
+          end--;
+        }
+        user_input[end] = '\0';
       }
-      // add NULL to the end of the tokens list (for execvp() call)
-      user_tokens[token_count] = NULL;
 
       // break the loop if the entered command is quit
       if (strcmp(user_tokens[0], "quit") == 0) {
-        free(user_input);
-        free(user_tokens);
         break;
       }
       // implementing the built in prompt command (extra credit)
       else if (strcmp(user_tokens[0], "prompt") == 0) {
         if ((user_tokens[1] != NULL)) {
-          strcpy(prompt, user_tokens[1]); // set new prompt based on user input
+          snprintf(prompt, MAX_INPUT_SIZE, "%s", user_tokens[1]); // set new prompt based on user input
         }
         else {
           printf("prompt error: must specify desired prompt\n");  // not counting in unknown commands
         }
-        free(user_input);
-        free(user_tokens);
         continue;
       }
       // implementing the built in cd command (extra credit)
@@ -86,78 +817,184 @@ int main() {
         else if (chdir(user_tokens[1]) < 0) {
           perror("chdir failure");
         };
-        free(user_input);
-        free(user_tokens);
+        continue;
+      }
+      // built in launcher command, shows or picks how commands are started
+      else if (strcmp(user_tokens[0], "launcher") == 0) {
+        if (user_tokens[1] == NULL) {
+          printf("launcher: %s\n", launcher_names[launcher]);
+        }
+        else if (strcmp(user_tokens[1], "spawn") == 0 || strcmp(user_tokens[1], "fork") == 0) {
+          launcher = user_tokens[1][0] == 's' ? LAUNCH_SPAWN : LAUNCH_FORK;
+        }
+        else {
+          printf("launcher error: must be spawn or fork\n");
+        }
+        continue;
+      }
+      // built in spawnstat command, reports how long launching commands took with each launcher
+      else if (strcmp(user_tokens[0], "spawnstat") == 0) {
+        for (int i = 0; i < 2; i++) {
+          launch_stats *timing = &launch_timings[i];
+          if (timing->launches == 0) {
+            printf("%s: no launches\n", launcher_names[i]);
+            continue;
+          }
+          printf("%s: %ld launches, mean %.1f us, min %.1f us, max %.1f us\n", launcher_names[i], timing->launches,
+            timing->total_ns / 1e3 / timing->launches, timing->min_ns / 1e3, timing->max_ns / 1e3);
+        }
+        continue;
+      }
+      // built in jobs command, lists the background jobs
+      else if (strcmp(user_tokens[0], "jobs") == 0) {
+        reap_jobs(jobs, &unknown_commands_count);
+        for (int i = 0; i < MAX_JOBS; i++) {
+          if (jobs[i].in_use && !jobs[i].quiet) {
+            printf("[%d] %s %s\n", i + 1, jobs[i].running > 0 ? "Running" : "Done", jobs[i].command);
+          }
+        }
+        continue;
+      }
+      // built in wait command, waits for one background job (wait N) or all of them
+      else if (strcmp(user_tokens[0], "wait") == 0) {
+        int id = user_tokens[1] == NULL ? 0 : atoi(user_tokens[1] + (user_tokens[1][0] == '%'));
+        if (user_tokens[1] != NULL && (id < 1 || id > MAX_JOBS || !jobs[id - 1].in_use || jobs[id - 1].quiet)) {
+          printf("wait error: no such job %s\n", user_tokens[1]);
+        }
+        else {
+          wait_for_jobs(jobs, id, sigchld_fd, &unknown_commands_count);
+          report_finished_jobs(jobs);
+        }
+        continue;
+      }
+      // built in parallel command, runs the command lines in a file with at most N at once (one per cpu by default)
+      else if (strcmp(user_tokens[0], "parallel") == 0) {
+        int max_running = sysconf(_SC_NPROCESSORS_ONLN);
+        char *path = user_tokens[1];
+        if (path != NULL && strcmp(path, "-j") == 0) {
+          max_running = user_tokens[2] != NULL ? atoi(user_tokens[2]) : 0;
+          path = user_tokens[2] != NULL ? user_tokens[3] : NULL;
+        }
+        if (path == NULL || max_running < 1) {
+          printf("parallel error: usage is parallel [-j N] file\n");
+          continue;
+        }
+        unread_input(&input);
+        if (run_parallel(path, max_running < MAX_JOBS ? max_running : MAX_JOBS, jobs, sigchld_fd, launcher,
+          launch_timings, &unknown_commands_count) < 0) {
+          free(prompt);
+          exit(1);
+        }
         continue;
       }
 
-      pid_t pid, child; // for holding process pid 
+      // built in stats command, totals the resource usage of every command line run so far
+      else if (strcmp(user_tokens[0], "stats") == 0) {
+        reap_jobs(jobs, &unknown_commands_count);
+        command_usage *total = &command_totals.total;
+        printf("Commands: %ld\n", command_totals.commands);
+        if (command_totals.commands > 0) {
+          printf("User CPU time: %ld.%06ld seconds, System CPU time: %ld.%06ld seconds\n", (long)total->utime.tv_sec,
+            (long)total->utime.tv_usec, (long)total->stime.tv_sec, (long)total->stime.tv_usec);
+          printf("Wall clock: %.6f seconds total, %.6f mean, %.6f max (%s)\n", total->wall_ns / 1e9,
+            total->wall_ns / 1e9 / command_totals.commands, command_totals.max_wall_ns / 1e9, command_totals.slowest);
+          printf("Peak resident set: %ld KB\n", total->max_rss_kb);
+          printf("Page faults: %ld minor, %ld major\n", total->minor_faults, total->major_faults);
+          printf("Context switches: %ld voluntary, %ld involuntary\n", total->voluntary_switches, total->involuntary_switches);
+        }
+        continue;
+      }
+      // built in statslog command, appends a csv row per command line to a file (statslog off stops)
+      else if (strcmp(user_tokens[0], "statslog") == 0) {
+        if (user_tokens[1] == NULL) {
+          printf("statslog error: must specify a file or off\n");
+        }
+        else {
+          if (stats_log != NULL) {
+            fclose(stats_log);
+            stats_log = NULL;
+          }
+          // close on exec like every other descriptor the shell opens, commands never see the log
+          if (strcmp(user_tokens[1], "off") != 0 && (stats_log = fopen(user_tokens[1], "ae")) == NULL) {
+            perror(user_tokens[1]);
+          }
+          else if (stats_log != NULL && ftell(stats_log) == 0) {
+            fprintf(stats_log, "command,status,wall_seconds,user_seconds,system_seconds,max_rss_kb,minor_faults,major_faults,"
+              "voluntary_switches,involuntary_switches\n");
+          }
+        }
+        continue;
+      }
+
+      unread_input(&input);
+      pipeline_stage stages[MAX_STAGES];
+      int stage_count = parse_pipeline(user_tokens, stages);
+      if (stage_count < 0) {
+        continue;
+      }
+
+      // a background job is announced and left running, the shell reaps it when SIGCHLD says it is done
+      job *background_job = NULL;
+      if (background && (background_job = add_job(jobs, user_input, false)) == NULL) {
+        printf("job error: already %d jobs running\n", MAX_JOBS);
+        continue;
+      }
+      pid_t pids[MAX_STAGES]; // for holding the pid of every stage that started
+      pid_t child; // for holding process pid 
       int status; // for holding exit status
-      struct rusage usage; // for holding resource usage information
+      struct rusage usage; // for holding resource usage information of one stage
+      command_usage command = {{0, 0}, {0, 0}, 0, 0, 0, 0, 0, 0}; // and of the whole command line
+      struct timespec started;
 
-      // fork a new process and ensure it succceded
-      if ((pid = fork()) < 0) {
-        free(user_input);
-        free(user_tokens);
+      clock_gettime(CLOCK_MONOTONIC, &started);
+      int launched = launch_pipeline(stages, stage_count, background ? background_job->pids : pids, launcher, launch_timings,
+        &unknown_commands_count);
+      // exit the process if no pipe or process could be created
+      if (launched < 0) {
         free(prompt);
-        perror("fork failure");
         exit(1);
       }
-      // the child calls execvp() to run the command and exit()
-      else if (pid == 0) {
-        // exit the process if an unknown command was entered
-        if (execvp(user_tokens[0], user_tokens) < 0) {
-          free(user_input);
-          free(user_tokens);
-          free(prompt);
-          perror("Unknown command");
-          exit(2); 
+      if (background) {
+        if (launched == 0) {
+          background_job->in_use = false;
         }
+        else {
+          background_job->stage_count = background_job->running = launched;
+          printf("[%d] %d\n", (int)(background_job - jobs) + 1, background_job->pids[launched - 1]);
+        }
+        continue;
       }
-      // the parent calls wait() to retrieve the child status
-      else {
-        child = waitpid(pid, &status, 0);
+
+      // the parent calls wait4() to retrieve the status and resource usage of every stage
+      int command_status = 0;
+      for (int i = 0; i < launched; i++) {
+        child = wait4(pids[i], &status, 0, &usage);
 
         // exit the process if the wait system call failed
         if (child < 1) {
-          free(user_input);
-          free(user_tokens);
-          free(prompt);
-          perror("waitpid error");
-          exit(1);
-        }
-        // exit the process if the getrusage system call failed
-        else if (getrusage(RUSAGE_CHILDREN, &usage) < 0) {
-          free(user_input);
-          free(user_tokens);
           free(prompt);
-          perror("getrusage error");
+          perror("wait4 error");
           exit(1);
         }
-
-        // calculate only recent child process usage information (since RUSAGE_CHILDREN is cumulative)
-        time_t  child_process_utime_sec = usage.ru_utime.tv_sec - total_children_utime.tv_sec;
-        suseconds_t child_process_utime_usec = usage.ru_utime.tv_usec - total_children_utime.tv_usec;
-        long child_process_nivcsw = usage.ru_nivcsw - total_children_nivcsw;
-        
-        // output the user cpu time used and # of involuntary context switches for the previous process
-        printf("User CPU time used: %ld.%06ld seconds\n", child_process_utime_sec,child_process_utime_usec);
-        printf("# of involuntary context switches: %ld\n", child_process_nivcsw);
-
-        // properly increment resource usage information
-        total_children_nivcsw +=  child_process_nivcsw;
-        total_children_utime.tv_sec += child_process_utime_sec;
-        total_children_utime.tv_usec += child_process_utime_usec;
-
-        // perform normal cleanup
-        free(user_input);
-        free(user_tokens);
+        add_usage(&command, &usage);
+        command_status = status; // the last stage's, like a shell's $?
 
         // increment the unknown commands counter if the exit status is 2
         if(WEXITSTATUS(status) == 2) {
           unknown_commands_count++;
         }
       }
+      if (launched == 0) {
+        continue;
+      }
+      record_command(user_input, command_status, &command, &started);
+      
+      // output the cpu time used and # of involuntary context switches for the previous command (all its stages)
+      printf("User CPU time used: %ld.%06ld seconds\n", (long)command.utime.tv_sec, (long)command.utime.tv_usec);
+      printf("System CPU time used: %ld.%06ld seconds\n", (long)command.stime.tv_sec, (long)command.stime.tv_usec);
+      printf("# of involuntary context switches: %ld\n", command.involuntary_switches);
+
+      // perform normal cleanup
   }
 
 // output the total number of unknown commands entered (for extra-credit)
@@ -165,6 +1002,14 @@ printf("# of unknown commands entered: %d\n", unknown_commands_count);
 
 // free the prompt to prevent a memory leak
 free(prompt);
+close(sigchld_fd);
+close_reader(&input);
+free(arena.line);
+free(arena.text);
+free(arena.tokens);
+if (stats_log != NULL) {
+  fclose(stats_log);
+}
 
 return 0;
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Runs every producer-consumer engine under the same benchmark workload (-B: no sleeps, no per-item output)
+# across buffer sizes, thread counts and batch sizes, and prints one csv row per run.
+#
+# usage: ./bench.sh > results.csv
+# environment overrides: ITEMS (items per producer), BUFFER_SIZES, THREADS (producers = consumers), BATCHES,
+# WAITS (wait strategies, -w)
+
+ITEMS=${ITEMS:-1000000}
+BUFFER_SIZES=${BUFFER_SIZES:-"16 256 4096"}
+THREADS=${THREADS:-"1 2 4 8"}
+BATCHES=${BATCHES:-"1 32"}
+WAITS=${WAITS:-"park"}
+# largest record of the bytes engine (header, an int and RECORD_MAX_FILL filler bytes, 8-byte aligned)
+RECORD_BYTES=80
+
+dir=$(cd "$(dirname "$0")" && pwd)
+bin=$(mktemp -d)
+trap 'rm -rf "$bin"' EXIT
+
+${CC:-gcc} -O2 -pthread -o "$bin/pc-c" "$dir/producer-consumer.c" || exit 1
+${CXX:-g++} -std=c++17 -O2 -pthread -o "$bin/pc-cpp" "$dir/producer-consumer.cpp" || exit 1
+
+echo "impl,mode,wait,buffer_size,producers,consumers,batch,items,seconds,items_per_sec,p50_ns,p99_ns,p999_ns"
+for size in $BUFFER_SIZES; do
+  for threads in $THREADS; do
+    for batch in $BATCHES; do
+      for wait in $WAITS; do
+        for engine in c:sem c:mpmc cpp:mutex cpp:spsc cpp:mpmc cpp:bytes; do
+          impl=${engine%%:*}
+          mode=${engine#*:}
+          if { [ "$mode" = spsc ] || [ "$mode" = bytes ]; } && [ "$threads" -ne 1 ]; then
+            continue # single producer / single consumer only
+          fi
+          if [ "$impl:$mode" = cpp:mpmc ] && [ "$size" -lt 2 ]; then
+            continue # needs two cells at least
+          fi
+          ring=$size
+          if [ "$mode" = bytes ]; then
+            # buffer_size is in bytes there, room for as many of the largest records as the other engines have items
+            # (and never less than the two largest records it needs)
+            ring=$((size * RECORD_BYTES))
+            if [ "$ring" -lt $((2 * RECORD_BYTES)) ]; then
+              ring=$((2 * RECORD_BYTES))
+            fi
+          fi
+          "$bin/pc-$impl" -m "$mode" -w "$wait" -p "$threads" -c "$threads" -k "$batch" -B "$ITEMS" "$ring" || exit 1
+        done
+      done
+    done
+  done
+done
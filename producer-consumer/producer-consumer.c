@@ -1,63 +1,304 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+// size of a cache line, used to keep slots written by different threads apart
+#define CACHE_LINE_SIZE 64
+// records a worker can queue before it has to wait for the log writer
+#define LOG_RING_SIZE 4096
+// size of the log writer's output buffer, flushed with a single write()
+#define LOG_FLUSH_SIZE 65536
+// longest command line accepted from stdin (including the newline)
+#define COMMAND_SIZE 32
+// number of pause iterations a waiting thread spins before it yields or parks
+#define SPIN_LIMIT 1024
+
+// the available buffer engines
+typedef enum {
+  MODE_SEM, // counting semaphores plus a mutex semaphore around the buffer
+  MODE_MPMC // counting semaphores plus sequence-numbered slots claimed with atomics (no mutex)
+} queue_mode;
+
+// how a producer or consumer waits for the other side
+typedef enum {
+  WAIT_SPIN,  // busy-spin with pause (for pinned cores and microsecond hand-offs)
+  WAIT_YIELD, // spin, then sched_yield between checks
+  WAIT_PARK   // spin, then sleep in sem_wait until a token is posted
+} wait_mode;
+
+// one slot of the mpmc buffer, padded so neighbouring slots written by different threads don't false-share
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong sequence; // == position when free for that position's producer, position + 1 once filled
+  int data;
+} mpmc_cell;
+
+// which workers this process runs
+typedef enum {
+  ROLE_BOTH,     // producers and consumers as threads of this process, the queue is private
+  ROLE_PRODUCER, // producers only, the queue lives in a named shared memory segment
+  ROLE_CONSUMER  // consumers only, attached to the same segment
+} process_role;
+
+// the bounded buffer and every counter the engines share, kept in one block so it can sit in shared memory
+// (no pointers inside, each process finds the cells or the buffer right after the header in its own mapping)
+typedef struct {
+  atomic_bool ready;           // set by the process that created the block once everything below is initialized
+  atomic_int attached;         // processes using the block, the last one out removes the segment
+  queue_mode mode;             // engine the block was laid out for
+  int buffer_size;
+  int buffer_count;            // sem mode, guarded by mutex
+  int producer_index, consumer_index; // sem mode, guarded by mutex
+  atomic_int producers_running; // producers (across every attached process) that haven't finished yet
+  atomic_bool producer_done;
+  sem_t mutex, empty, full;    // process-shared when the block is in shared memory
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong enqueue_pos; // next position a producer will claim in mpmc mode
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong dequeue_pos; // next position a consumer will claim in mpmc mode
+} shared_queue;
+
+// events a worker can log, formatted later by the log writer thread
+typedef enum {
+  LOG_PUT,
+  LOG_GET,
+  LOG_END_PRODUCER,
+  LOG_END_CONSUMER
+} log_event;
+
+typedef struct {
+  log_event event;
+  int item;
+  int bin;
+} log_record;
+
+// per-worker log buffer, only the owning worker appends and only the log writer drains
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong tail; // next record the worker will write
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong head; // next record the log writer will format
+  log_record records[LOG_RING_SIZE];
+} log_ring;
+
+// paces one worker to a target rate with absolute deadlines, so time spent working or blocked doesn't add drift
+typedef struct {
+  double rate;          // items/sec the current schedule was built for (0 = unthrottled)
+  uint64_t deadline_ns; // when the next batch may start
+} pacer;
+
 void* producer(void *arg);
 void* consumer(void *arg);
+void log_append(log_event event, int item, int bin);
+void log_flush(const char *out, size_t used);
+void* log_writer(void *arg);
+int queue_put(const int *items, int count, int *bin);
+int queue_get(int *items, int max_count, int *bin);
+void queue_close();
+size_t queue_size();
+void queue_attach();
+void queue_detach();
+void spin_wait(int spins);
+int take_tokens(sem_t *sem, int max_count);
+void post_tokens(sem_t *sem, int count);
+uint64_t now_ns();
+double target_rate(double rate, int sleep_time);
+void pace_wait(pacer *p, double rate);
+void pace_charge(pacer *p, int items);
+void* bench_producer(void *arg);
+void* bench_consumer(void *arg);
+int compare_stamps(const void *a, const void *b);
+void bench_report(double seconds);
+int sem_put(const int *items, int count, int *bin);
+int sem_get(int *items, int max_count, int *bin);
+int mpmc_put(const int *items, int count, int *bin);
+int mpmc_get(int *items, int max_count, int *bin);
 
 int buffer_size;
-int *buffer;
+int *buffer; // the sem engine's slots, inside the queue block
 char *command_buffer;
-bool producer_done;
-sem_t mutex, empty, full;
-int producer_index, consumer_index;
+int num_producers = 1, num_consumers = 1;
+int batch_size = 1; // most items moved per put/get
+long bench_items = 0; // items per producer in benchmark mode (0 runs the interactive program)
+uint64_t *bench_stamps; // enqueue time of each benchmark item, replaced by its latency once consumed
+int producer_sleep_time, consumer_sleep_time; // shared by all producers / all consumers
+double producer_rate = -1, consumer_rate = -1; // items/sec per worker, negative to pace by sleep time instead
+bool rate_mode = false; // the pacing arguments are items/sec rather than sleep ms
+sem_t mutex; // guards command_buffer (the queue has its own)
+queue_mode mode = MODE_SEM;
+wait_mode waiting = WAIT_PARK;
+int spin_limit = SPIN_LIMIT; // rounds spent spinning before yielding or parking
+shared_queue *queue;
+mpmc_cell *cells; // the mpmc engine's slots, inside the queue block
+process_role role = ROLE_BOTH;
+char shm_name[NAME_MAX]; // name of the shared memory segment in producer/consumer roles
+atomic_bool detaching; // set by q in producer/consumer roles, workers blocked on the shared queue give up
+int verbosity = 1; // 0 only logs when workers end, 1 also logs every item
+log_ring *log_rings; // producers' rings first, then consumers'
+atomic_bool log_stop; // set once every worker has exited, the log writer then drains and exits
+_Thread_local log_ring *thread_log; // the calling worker's log ring
 
 int main(int argc, char *argv[]) {
-  pthread_t producer_thread, consumer_thread;
-
-  if(argc < 4) {
+  int opt;
+  while((opt = getopt(argc, argv, "m:p:c:k:B:v:rs:n:w:")) != -1) {
+    if(opt == 'm' && strcmp(optarg, "sem") == 0) {
+      mode = MODE_SEM;
+    }
+    else if(opt == 'm' && strcmp(optarg, "mpmc") == 0) {
+      mode = MODE_MPMC;
+    }
+    else if(opt == 'p') {
+      num_producers = atoi(optarg);
+    }
+    else if(opt == 'c') {
+      num_consumers = atoi(optarg);
+    }
+    else if(opt == 'k') {
+      batch_size = atoi(optarg);
+    }
+    else if(opt == 'B') {
+      bench_items = atol(optarg);
+    }
+    else if(opt == 'v') {
+      verbosity = atoi(optarg);
+    }
+    else if(opt == 'r') {
+      rate_mode = true;
+    }
+    else if(opt == 's' && strcmp(optarg, "producer") == 0) {
+      role = ROLE_PRODUCER;
+    }
+    else if(opt == 's' && strcmp(optarg, "consumer") == 0) {
+      role = ROLE_CONSUMER;
+    }
+    else if(opt == 'n') {
+      snprintf(shm_name, sizeof(shm_name), "/%s", optarg);
+    }
+    else if(opt == 'w' && strcmp(optarg, "spin") == 0) {
+      waiting = WAIT_SPIN;
+    }
+    else if(opt == 'w' && strcmp(optarg, "yield") == 0) {
+      waiting = WAIT_YIELD;
+    }
+    else if(opt == 'w' && strcmp(optarg, "park") == 0) {
+      waiting = WAIT_PARK;
+    }
+    else {
+      fprintf(stderr, "Usage: %s [-m sem|mpmc] [-p producers] [-c consumers] [-k batch_size] [-B items] [-v verbosity] [-r] [-w spin|yield|park] [-s producer|consumer [-n name]] buffer_size [producer_sleep consumer_sleep]\n", argv[0]);
+      fprintf(stderr, "  -r takes the producer/consumer pacing as target items/sec per worker instead of sleep ms\n");
+      fprintf(stderr, "  -w picks how blocked workers wait: busy-spin, spin then yield, or spin then sleep (default)\n");
+      fprintf(stderr, "  -s runs only that side, attached to a queue in shared memory (/dev/shm/pc-queue-<uid> unless named with -n)\n");
+      exit(1);
+    }
+  }
+  if(argc - optind < (bench_items > 0 ? 1 : 3)) {
     fprintf(stderr, "Err: must specify buffer size, producer sleep time, and consumer sleep time\n");
     exit(1);
   }
-  buffer_size = atoi(argv[1]); // desired size of the buffer
-  int producer_sleep_time = atoi(argv[2]); // desired sleep time for the producer
-  int consumer_sleep_time = atoi(argv[3]); // desired sleep time for the consumer
+  if(num_producers < 1 || num_consumers < 1) {
+    fprintf(stderr, "Err: must have at least one producer and one consumer\n");
+    exit(1);
+  }
+  if(batch_size < 1) {
+    fprintf(stderr, "Err: batch size must be at least one\n");
+    exit(1);
+  }
+  if(bench_items < 0 || bench_items * num_producers > INT_MAX) {
+    fprintf(stderr, "Err: benchmark item count must be positive and fit every item id in an int\n");
+    exit(1);
+  }
+  if(bench_items > 0 && role != ROLE_BOTH) {
+    fprintf(stderr, "Err: benchmark mode runs both sides in one process\n");
+    exit(1);
+  }
+  // a process only counts the workers it runs itself
+  if(role == ROLE_PRODUCER) {
+    num_consumers = 0;
+  }
+  else if(role == ROLE_CONSUMER) {
+    num_producers = 0;
+  }
+  if(role != ROLE_BOTH && shm_name[0] == '\0') {
+    // to avoid name conflicts, append the uid as a suffix for the shared memory name
+    snprintf(shm_name, sizeof(shm_name), "/pc-queue-%d", getuid());
+  }
+  if(sysconf(_SC_NPROCESSORS_ONLN) == 1) {
+    spin_limit = 0; // the other side can't run while we spin on a single cpu, so yield or park straight away
+  }
+  buffer_size = atoi(argv[optind]); // desired size of the buffer
+  if(bench_items == 0 && rate_mode) {
+    producer_rate = atof(argv[optind + 1]); // desired items/sec for each producer
+    consumer_rate = atof(argv[optind + 2]); // desired items/sec for each consumer
+  }
+  else if(bench_items == 0) {
+    producer_sleep_time = atoi(argv[optind + 1]); // desired sleep time for the producers
+    consumer_sleep_time = atoi(argv[optind + 2]); // desired sleep time for the consumers
+  }
 
-  // initialize the buffer
-  buffer = malloc(sizeof(int) * buffer_size);
-  command_buffer = malloc(sizeof(char) * 2);
+  pthread_t *producer_threads = malloc(sizeof(pthread_t) * num_producers);
+  pthread_t *consumer_threads = malloc(sizeof(pthread_t) * num_consumers);
+  int *worker_ids = malloc(sizeof(int) * (num_producers + num_consumers));
+  pthread_t log_thread;
 
-  // initialize the producer done boolean
-  producer_done = false;
+  // create the queue, or attach to the one another process already set up
+  queue_attach();
 
-  // initialize necessary semaphores
+  command_buffer = malloc(sizeof(char) * COMMAND_SIZE);
+  strcpy(command_buffer, " \n");
+
+  // initialize the command buffer's semaphore
   sem_init(&mutex, 0, 1);
-  sem_init(&empty, 0, buffer_size);
-  sem_init(&full, 0, 0);
 
-  // initialize the procucer and consumer index
-  producer_index = 0;
-  consumer_index = 0;
-  
-  pthread_create(&producer_thread, NULL, producer, &producer_sleep_time); // create the producer thread
-  pthread_create(&consumer_thread, NULL, consumer, &consumer_sleep_time);  // create the consumer thread
+  // benchmark mode runs a fixed workload with no sleeps, no printing and no command loop
+  struct timespec start, end;
+  if(bench_items > 0) {
+    bench_stamps = malloc(sizeof(uint64_t) * bench_items * num_producers);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  }
+  else {
+    // give every worker its own log ring and start the thread that writes them out
+    log_rings = aligned_alloc(CACHE_LINE_SIZE, sizeof(log_ring) * (num_producers + num_consumers));
+    for(int i=0; i<num_producers + num_consumers; i++) {
+      atomic_init(&log_rings[i].head, 0);
+      atomic_init(&log_rings[i].tail, 0);
+    }
+    atomic_init(&log_stop, false);
+    pthread_create(&log_thread, NULL, log_writer, NULL);
+  }
+
+  // create the producer and consumer threads (each is passed its worker number, producers first)
+  for(int i=0; i<num_producers; i++) {
+    worker_ids[i] = i;
+    pthread_create(&producer_threads[i], NULL, bench_items > 0 ? bench_producer : producer, &worker_ids[i]);
+  }
+  for(int i=0; i<num_consumers; i++) {
+    worker_ids[num_producers + i] = num_producers + i;
+    pthread_create(&consumer_threads[i], NULL, bench_items > 0 ? bench_consumer : consumer, &worker_ids[num_producers + i]);
+  }
 
-  char user_input[2];
+  char user_input[COMMAND_SIZE];
   // core loop to recieve user commands
-  while(true) {
+  while(bench_items == 0) {
     // printf("Enter desired command: ");
-    fgets(user_input, 3, stdin);
+    if(fgets(user_input, COMMAND_SIZE, stdin) == NULL) {
+      strcpy(user_input, "q\n"); // treat end of input as quit
+    }
     if(strcmp(user_input, "q\n") == 0) {
       printf("Preparing to quit\n");
+      fflush(stdout); // the log writer bypasses stdio
+      atomic_store(&detaching, role != ROLE_BOTH); // the other side may not be running to unblock us
     }
 
     sem_wait(&mutex); // wait for the mutex semaphore to unlock
-    
+
     strcpy(command_buffer, user_input);
 
     sem_post(&mutex);
@@ -67,105 +308,658 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  int producer_val, consumer_val;
-  pthread_join(producer_thread, (void **) &producer_val); // join the producer thread
-  pthread_join(consumer_thread, (void **) &consumer_val); // join the consumer thread
+  // join the producer and consumer threads
+  for(int i=0; i<num_producers; i++) {
+    pthread_join(producer_threads[i], NULL);
+  }
+  for(int i=0; i<num_consumers; i++) {
+    pthread_join(consumer_threads[i], NULL);
+  }
+
+  if(bench_items > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    bench_report((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    free(bench_stamps);
+  }
+  else {
+    // let the log writer drain what the workers left behind
+    atomic_store(&log_stop, true);
+    pthread_join(log_thread, NULL);
+    free(log_rings);
+  }
 
-  // release the semaphores
-  sem_destroy(&full);
-  sem_destroy(&empty);
   sem_destroy(&mutex);
+  queue_detach();
 
-  free(buffer); // free the buffer
   free(command_buffer); // free the command buffer
+  free(producer_threads);
+  free(consumer_threads);
+  free(worker_ids);
 
   return 0;
 }
 
 void* producer(void *arg) {
   // need upper bound to be 8001 so that rand() % upper_bound generates from 0-8000, then add 1000 so final range is 1000-9000
-  int upper_bound = 8001; 
-  int sleep_time = *(int *)arg;
-  int next_produced;
+  int upper_bound = 8001;
+  int bin, placed;
+  double rate;
+  bool quit;
+  pacer pace = {0, 0};
+  int *next_produced = malloc(sizeof(int) * batch_size);
+  thread_log = &log_rings[*(int *)arg];
 
-  srand(time(NULL)); // seed the random number generator with the current time
+  // each producer keeps its own seed (rand() serializes every thread on a hidden lock)
+  unsigned int seed = time(NULL) ^ (unsigned int)pthread_self();
 
   while (true) {
-    // produce an item in next_produced
-    next_produced = (rand() % (upper_bound)) + 1000; // generate a random number between 1000 and 9000
+    // produce a batch of items in next_produced
+    for(int i=0; i<batch_size; i++) {
+      next_produced[i] = (rand_r(&seed) % (upper_bound)) + 1000; // generate a random number between 1000 and 9000
+    }
 
-    sem_wait(&empty); // wait for the empty semaphore to unlock
     sem_wait(&mutex); // wait for the mutex semaphore to unlock
-
     if(strcmp(command_buffer, "a\n") == 0) {
-      sleep_time += 250;
+      // slow down: halve the rate, or sleep longer
+      if(producer_rate >= 0) {
+        producer_rate /= 2;
+      }
+      else {
+        producer_sleep_time += 250;
+      }
       strcpy(command_buffer, " \n"); // clear the buffer
     }
     else if(strcmp(command_buffer, "z\n") == 0) {
-      sleep_time -= 250;
+      // speed up: double the rate, or sleep less
+      if(producer_rate >= 0) {
+        producer_rate *= 2;
+      }
+      else {
+        producer_sleep_time -= 250;
+      }
       strcpy(command_buffer, " \n"); // clear the buffer
     }
+    else if(strncmp(command_buffer, "p=", 2) == 0) {
+      producer_rate = atof(command_buffer + 2); // switch to an exact items/sec
+      strcpy(command_buffer, " \n"); // clear the buffer
+    }
+    rate = target_rate(producer_rate, producer_sleep_time);
     sem_post(&mutex);
 
-    usleep(sleep_time * 1000); // sleep for the desired time
-
-    sem_wait(&mutex);
-    // add next_produced to the buffer
-    buffer[producer_index] = next_produced;
-    sem_post(&full);
-    sem_post(&mutex);
+    // wait for this batch's deadline
+    pace_wait(&pace, rate);
+    pace_charge(&pace, batch_size);
 
-    printf("Put %d into bin %d\n", next_produced, producer_index);
-    producer_index = (producer_index + 1) % buffer_size; // make indexing wrap around
+    // add next_produced to the buffer, the engine may take fewer than asked if the buffer is nearly full
+    for(int done = 0; done < batch_size; done += placed) {
+      placed = queue_put(&next_produced[done], batch_size - done, &bin);
+      if(placed == 0) {
+        break; // q detached us while we waited for room, the rest of the batch is dropped
+      }
+      for(int i=0; i<placed; i++) {
+        log_append(LOG_PUT, next_produced[done + i], (bin + i) % buffer_size);
+      }
+    }
 
     sem_wait(&mutex);
-    if(strcmp(command_buffer, "q\n") == 0) {
-      producer_done = true;
-      sem_post(&mutex);
+    quit = strcmp(command_buffer, "q\n") == 0; // left in the buffer so every producer sees it
+    sem_post(&mutex);
+    if(quit) {
       break; // break if q is in the command buffer
     }
-    sem_post(&mutex);
   }
-  printf("End of producer\n");
+
+  // the last producer out wakes the consumers so they can drain the buffer and exit
+  if(atomic_fetch_sub(&queue->producers_running, 1) == 1) {
+    queue_close();
+  }
+  free(next_produced);
+  log_append(LOG_END_PRODUCER, 0, 0);
   return 0;
 }
 
 void* consumer(void *arg) {
-  int next_consumed;
-  int sleep_time = *(int *)arg;
+  int bin, taken;
+  double rate;
+  pacer pace = {0, 0};
+  int *next_consumed = malloc(sizeof(int) * batch_size);
+  thread_log = &log_rings[*(int *)arg];
   while (true) {
-    sem_wait(&full); // wait for the full semaphore to unlock
     sem_wait(&mutex); // wait for the mutex semaphore to unlock
-
     if(strcmp(command_buffer, "s\n") == 0) {
-      sleep_time += 250;
+      // slow down: halve the rate, or sleep longer
+      if(consumer_rate >= 0) {
+        consumer_rate /= 2;
+      }
+      else {
+        consumer_sleep_time += 250;
+      }
       strcpy(command_buffer, " \n"); // clear the buffer
     }
     else if(strcmp(command_buffer, "x\n") == 0) {
-      sleep_time -= 250;
+      // speed up: double the rate, or sleep less
+      if(consumer_rate >= 0) {
+        consumer_rate *= 2;
+      }
+      else {
+        consumer_sleep_time -= 250;
+      }
+      strcpy(command_buffer, " \n"); // clear the buffer
+    }
+    else if(strncmp(command_buffer, "c=", 2) == 0) {
+      consumer_rate = atof(command_buffer + 2); // switch to an exact items/sec
       strcpy(command_buffer, " \n"); // clear the buffer
     }
+    rate = target_rate(consumer_rate, consumer_sleep_time);
     sem_post(&mutex);
+    if(atomic_load(&detaching)) {
+      break; // a consumer-only process leaves on q, the items stay queued for a later consumer
+    }
 
-    usleep(sleep_time * 1000); // sleep for the desired time
+    // wait for this batch's deadline
+    pace_wait(&pace, rate);
 
-    sem_wait(&mutex);
-    // remove an item from buffer to next_consumed
-    next_consumed = buffer[consumer_index];
-    sem_post(&empty);
-    sem_post(&mutex);
+    // remove up to a batch of items from buffer to next_consumed (none once the producers are done and the buffer is drained)
+    taken = queue_get(next_consumed, batch_size, &bin);
+    if(taken == 0) {
+      break;
+    }
+    pace_charge(&pace, taken); // only pay for what we actually got
 
-    // consume the item in next_consumed
-    printf("\tGet %d from bin %d\n", next_consumed, consumer_index);
-    consumer_index = (consumer_index + 1) % buffer_size; // make indexing wrap around
+    // consume the items in next_consumed
+    for(int i=0; i<taken; i++) {
+      log_append(LOG_GET, next_consumed[i], (bin + i) % buffer_size);
+    }
+  }
+  free(next_consumed);
+  log_append(LOG_END_CONSUMER, 0, 0);
+  return 0;
+}
 
-    sem_wait(&mutex);
-    if(strcmp(command_buffer, "q\n") == 0 && consumer_index == producer_index && producer_done) {
-      sem_post(&mutex);
-      break; // break if q is in the command_buffer
+void log_append(log_event event, int item, int bin) {
+  // queue a record on the calling worker's log ring, the log writer formats and writes it later
+  if(verbosity < 1 && (event == LOG_PUT || event == LOG_GET)) {
+    return; // per-item logging is turned off
+  }
+  log_ring *lr = thread_log;
+  unsigned long tail = atomic_load_explicit(&lr->tail, memory_order_relaxed);
+
+  // wait for the log writer if our ring is full (slowing down beats dropping lines)
+  while(tail - atomic_load_explicit(&lr->head, memory_order_acquire) == LOG_RING_SIZE) {
+    sched_yield();
+  }
+  lr->records[tail % LOG_RING_SIZE] = (log_record) {event, item, bin};
+  atomic_store_explicit(&lr->tail, tail + 1, memory_order_release);
+}
+
+void log_flush(const char *out, size_t used) {
+  // write the whole output buffer to stdout, retrying on partial writes
+  while(used > 0) {
+    ssize_t written = write(STDOUT_FILENO, out, used);
+    if(written < 0) {
+      return; // nowhere to report the error, drop the batch
+    }
+    out += written;
+    used -= written;
+  }
+}
+
+void* log_writer(void *arg) {
+  // drain every worker's ring into one large buffer and write it out in big batches
+  char *out = malloc(LOG_FLUSH_SIZE);
+  size_t used = 0;
+  (void)arg;
+
+  while(true) {
+    bool stopping = atomic_load(&log_stop); // read before draining so the last pass sees every record
+    bool drained = false;
+
+    for(int i=0; i<num_producers + num_consumers; i++) {
+      log_ring *lr = &log_rings[i];
+      unsigned long head = atomic_load_explicit(&lr->head, memory_order_relaxed);
+      unsigned long tail = atomic_load_explicit(&lr->tail, memory_order_acquire);
+      for(; head != tail; head++) {
+        if(used > LOG_FLUSH_SIZE - 64) { // room for the longest record
+          log_flush(out, used);
+          used = 0;
+        }
+        log_record *rec = &lr->records[head % LOG_RING_SIZE];
+        if(rec->event == LOG_PUT) {
+          used += snprintf(out + used, 64, "Put %d into bin %d\n", rec->item, rec->bin);
+        }
+        else if(rec->event == LOG_GET) {
+          used += snprintf(out + used, 64, "\tGet %d from bin %d\n", rec->item, rec->bin);
+        }
+        else if(rec->event == LOG_END_PRODUCER) {
+          used += snprintf(out + used, 64, "End of producer\n");
+        }
+        else {
+          used += snprintf(out + used, 64, "\tEnd of consumer\n");
+        }
+        drained = true;
+      }
+      atomic_store_explicit(&lr->head, head, memory_order_release); // hand the slots back to the worker
+    }
+
+    if(!drained) {
+      // nothing new, so push out what we have rather than holding it back
+      log_flush(out, used);
+      used = 0;
+      if(stopping) {
+        break;
+      }
+      usleep(1000);
     }
-    sem_post(&mutex);
   }
-  printf("\tEnd of consumer\n");
+  free(out);
   return 0;
+}
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+double target_rate(double rate, int sleep_time) {
+  // the items/sec a worker should run at, a sleep time is one batch per sleep_time ms
+  if(rate >= 0) {
+    return rate;
+  }
+  return sleep_time > 0 ? batch_size * 1000.0 / sleep_time : 0;
+}
+
+void pace_wait(pacer *p, double rate) {
+  // sleep until the next deadline on the schedule for rate (0 = unthrottled)
+  if(rate <= 0) {
+    p->rate = 0;
+    return;
+  }
+  uint64_t now = now_ns();
+  uint64_t burst_ns = batch_size * 1e9 / rate; // the bucket holds one batch worth of credit
+  if(rate != p->rate) {
+    // first batch or the rate was changed: start a fresh schedule from now
+    p->rate = rate;
+    p->deadline_ns = now;
+  }
+  else if(p->deadline_ns + burst_ns < now) {
+    // we fell behind (blocked on the buffer), catch up by at most one batch rather than bursting
+    p->deadline_ns = now - burst_ns;
+  }
+  if(p->deadline_ns > now) {
+    struct timespec ts = {p->deadline_ns / 1000000000, p->deadline_ns % 1000000000};
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+      // absolute deadline, so simply sleep again
+    }
+  }
+}
+
+void pace_charge(pacer *p, int items) {
+  // move the deadline on by the time items take at the current rate
+  if(p->rate > 0) {
+    p->deadline_ns += items * 1e9 / p->rate;
+  }
+}
+
+void* bench_producer(void *arg) {
+  // item values are ids into bench_stamps, so consumers can find when each item was enqueued
+  int id = *(int *)arg;
+  int first_item = id * bench_items;
+  int *items = malloc(sizeof(int) * batch_size);
+  int bin;
+
+  for(long produced = 0; produced < bench_items; ) {
+    int count = bench_items - produced < batch_size ? bench_items - produced : batch_size;
+    for(int i=0; i<count; i++) {
+      items[i] = first_item + produced + i;
+    }
+    uint64_t now = now_ns();
+    for(int i=0; i<count; i++) {
+      bench_stamps[items[i]] = now;
+    }
+    for(int done = 0; done < count; ) {
+      done += queue_put(&items[done], count - done, &bin);
+    }
+    produced += count;
+  }
+
+  if(atomic_fetch_sub(&queue->producers_running, 1) == 1) {
+    queue_close();
+  }
+  free(items);
+  return 0;
+}
+
+void* bench_consumer(void *arg) {
+  int *items = malloc(sizeof(int) * batch_size);
+  int bin, taken;
+  (void)arg;
+
+  while((taken = queue_get(items, batch_size, &bin)) > 0) {
+    uint64_t now = now_ns();
+    for(int i=0; i<taken; i++) {
+      bench_stamps[items[i]] = now - bench_stamps[items[i]]; // the queue hand-off orders this after the producer's stamp
+    }
+  }
+  free(items);
+  return 0;
+}
+
+int compare_stamps(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void bench_report(double seconds) {
+  // print one machine-readable csv row:
+  // impl,mode,wait,buffer_size,producers,consumers,batch,items,seconds,items_per_sec,p50_ns,p99_ns,p999_ns
+  const char *mode_names[] = {"sem", "mpmc"};
+  const char *wait_names[] = {"spin", "yield", "park"};
+  long total = bench_items * num_producers;
+
+  qsort(bench_stamps, total, sizeof(uint64_t), compare_stamps);
+  printf("c,%s,%s,%d,%d,%d,%d,%ld,%.6f,%.0f,%llu,%llu,%llu\n", mode_names[mode], wait_names[waiting], buffer_size, num_producers,
+    num_consumers, batch_size, total, seconds, total / seconds,
+    (unsigned long long)bench_stamps[(long)((total - 1) * 0.5)],
+    (unsigned long long)bench_stamps[(long)((total - 1) * 0.99)],
+    (unsigned long long)bench_stamps[(long)((total - 1) * 0.999)]);
+}
+
+int queue_put(const int *items, int count, int *bin) {
+  // add up to count items to the buffer using the selected engine in one critical section,
+  // returns how many were added (at least one, or 0 if q detached us while we waited) and the bin the first one was placed in
+  if(mode == MODE_MPMC) {
+    return mpmc_put(items, count, bin);
+  }
+  return sem_put(items, count, bin);
+}
+
+int queue_get(int *items, int max_count, int *bin) {
+  // remove up to max_count items from the buffer using the selected engine in one critical section,
+  // returns how many were removed and the bin of the first one (0 once the producers are done and the buffer is empty)
+  if(mode == MODE_MPMC) {
+    return mpmc_get(items, max_count, bin);
+  }
+  return sem_get(items, max_count, bin);
+}
+
+static inline void cpu_relax() {
+  // tell the cpu we are in a spin loop (saves power and frees the sibling hyperthread)
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
+
+void spin_wait(int spins) {
+  // one round of busy waiting: pause for the first spin_limit rounds (every round with -w spin), then yield the cpu
+  if(waiting == WAIT_SPIN || spins < spin_limit) {
+    cpu_relax();
+  }
+  else {
+    sched_yield();
+  }
+}
+
+int take_tokens(sem_t *sem, int max_count) {
+  // wait for one token under the selected strategy, then take as many more as are available without waiting
+  // (up to max_count), returns 0 if q detached us while we waited
+  int tokens = 1;
+  for(int spins = 0; sem_trywait(sem) < 0; spins++) {
+    if(role != ROLE_BOTH && atomic_load(&detaching)) {
+      return 0;
+    }
+    if(waiting != WAIT_PARK || spins < spin_limit) {
+      spin_wait(spins);
+    }
+    else if(role == ROLE_BOTH) {
+      sem_wait(sem);
+      break;
+    }
+    else {
+      // the other side of a shared queue may not be running to post a token, so check for q every 100ms
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 100000000;
+      if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+      if(sem_timedwait(sem, &ts) == 0) {
+        break;
+      }
+    }
+  }
+  while(tokens < max_count && sem_trywait(sem) == 0) {
+    tokens++;
+  }
+  return tokens;
+}
+
+void post_tokens(sem_t *sem, int count) {
+  for(int i=0; i<count; i++) {
+    sem_post(sem);
+  }
+}
+
+void queue_close() {
+  // mark the producers as done, then post one extra full token so a blocked consumer wakes up, finds the buffer
+  // drained and exits, handing the token on to the next one (consumers in other processes included)
+  atomic_store(&queue->producer_done, true);
+  sem_post(&queue->full);
+}
+
+size_t queue_size() {
+  // bytes of the queue block, the header and then only the storage of the engine in use
+  return sizeof(shared_queue) + (mode == MODE_MPMC ? sizeof(mpmc_cell) : sizeof(int)) * buffer_size;
+}
+
+void queue_attach() {
+  // set up the queue block, privately for ROLE_BOTH, otherwise in the shm_name segment which the first process
+  // to arrive creates and initializes while later ones wait for it to be ready
+  size_t size = queue_size();
+  bool creator = true;
+
+  if(role == ROLE_BOTH) {
+    queue = aligned_alloc(CACHE_LINE_SIZE, size);
+  }
+  else {
+    int shm_fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if(shm_fd < 0 && errno == EEXIST) {
+      creator = false;
+      shm_fd = shm_open(shm_name, O_RDWR, 0);
+    }
+    if(shm_fd < 0) {
+      perror("shm_open failed");
+      exit(1);
+    }
+    if(creator) {
+      if(ftruncate(shm_fd, size) < 0) {
+        perror("ftruncate failed");
+        shm_unlink(shm_name);
+        exit(1);
+      }
+    }
+    else {
+      // the creator may not have sized the segment yet, the mapping then takes whatever size it was given
+      struct stat st;
+      while(fstat(shm_fd, &st) < 0 || st.st_size == 0) {
+        usleep(1000);
+      }
+      size = st.st_size;
+    }
+    queue = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd); // the mapping keeps the segment open
+    if(queue == MAP_FAILED) {
+      perror("mmap failed");
+      exit(1);
+    }
+  }
+
+  if(creator) {
+    // cell i starts out free for position i
+    queue->mode = mode;
+    queue->buffer_size = buffer_size;
+    queue->buffer_count = 0;
+    queue->producer_index = 0;
+    queue->consumer_index = 0;
+    atomic_init(&queue->producers_running, 0);
+    atomic_init(&queue->producer_done, false);
+    atomic_init(&queue->attached, 0);
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    sem_init(&queue->mutex, role != ROLE_BOTH, 1);
+    sem_init(&queue->empty, role != ROLE_BOTH, buffer_size);
+    sem_init(&queue->full, role != ROLE_BOTH, 0);
+    if(mode == MODE_MPMC) {
+      cells = (mpmc_cell *)(queue + 1);
+      for(int i=0; i<buffer_size; i++) {
+        atomic_init(&cells[i].sequence, i);
+      }
+    }
+    atomic_store(&queue->ready, true);
+  }
+  while(!atomic_load(&queue->ready)) {
+    usleep(1000);
+  }
+
+  // the creator's layout wins, the arguments of later processes have to agree with it
+  if(queue->mode != mode) {
+    fprintf(stderr, "Err: shared queue %s uses a different engine (-m)\n", shm_name);
+    exit(1);
+  }
+  if(queue->buffer_size != buffer_size) {
+    fprintf(stderr, "Err: shared queue %s has buffer size %d\n", shm_name, queue->buffer_size);
+    exit(1);
+  }
+  if(atomic_load(&queue->producer_done) && role == ROLE_PRODUCER) {
+    fprintf(stderr, "Err: shared queue %s was already closed by its producers, remove it from /dev/shm\n", shm_name);
+    exit(1);
+  }
+  // the cells (mpmc mode) or the buffer (sem mode) follow the header
+  cells = mode == MODE_MPMC ? (mpmc_cell *)(queue + 1) : NULL;
+  buffer = mode == MODE_SEM ? (int *)(queue + 1) : NULL;
+  atomic_fetch_add(&queue->attached, 1);
+  atomic_fetch_add(&queue->producers_running, num_producers);
+}
+
+void queue_detach() {
+  // release the queue block, the last process out removes the segment unless items are still waiting for a consumer
+  size_t size = queue_size();
+  bool last = atomic_fetch_sub(&queue->attached, 1) == 1;
+  bool drained = atomic_load(&queue->producer_done) && queue->buffer_count == 0 &&
+    atomic_load(&queue->enqueue_pos) == atomic_load(&queue->dequeue_pos);
+
+  if(role == ROLE_BOTH || (last && drained)) {
+    sem_destroy(&queue->full);
+    sem_destroy(&queue->empty);
+    sem_destroy(&queue->mutex);
+  }
+  if(role == ROLE_BOTH) {
+    free(queue);
+    return;
+  }
+  munmap(queue, size);
+  if(last && drained) {
+    shm_unlink(shm_name);
+  }
+}
+
+int sem_put(const int *items, int count, int *bin) {
+  int n = take_tokens(&queue->empty, count); // wait for free slots
+  if(n == 0) {
+    return 0;
+  }
+  sem_wait(&queue->mutex); // wait for the mutex semaphore to unlock
+
+  *bin = queue->producer_index;
+  for(int i=0; i<n; i++) {
+    buffer[queue->producer_index] = items[i];
+    queue->producer_index = (queue->producer_index + 1) % buffer_size; // make indexing wrap around
+  }
+  queue->buffer_count += n;
+
+  sem_post(&queue->mutex);
+  post_tokens(&queue->full, n);
+  return n;
+}
+
+int sem_get(int *items, int max_count, int *bin) {
+  int tokens = take_tokens(&queue->full, max_count); // wait for items (or wake-up tokens from queue_close())
+  if(tokens == 0) {
+    return 0;
+  }
+  sem_wait(&queue->mutex); // wait for the mutex semaphore to unlock
+
+  int n = tokens < queue->buffer_count ? tokens : queue->buffer_count;
+  *bin = queue->consumer_index;
+  for(int i=0; i<n; i++) {
+    items[i] = buffer[queue->consumer_index];
+    queue->consumer_index = (queue->consumer_index + 1) % buffer_size; // make indexing wrap around
+  }
+  queue->buffer_count -= n;
+
+  sem_post(&queue->mutex);
+  // return the wake-up tokens we can't use to the other consumers (they exit on them too once nothing is left)
+  post_tokens(&queue->full, tokens - n);
+  post_tokens(&queue->empty, n);
+  return n; // 0 means this was a wake-up token and everything has been consumed
+}
+
+int mpmc_put(const int *items, int count, int *bin) {
+  int n = take_tokens(&queue->empty, count); // n slots are free somewhere, claim the next n positions
+  if(n == 0) {
+    return 0;
+  }
+
+  unsigned long pos = atomic_fetch_add_explicit(&queue->enqueue_pos, n, memory_order_relaxed);
+  for(int i=0; i<n; i++) {
+    mpmc_cell *cell = &cells[(pos + i) % buffer_size];
+
+    // the consumer of the previous lap may still be reading this cell, wait for it to hand it back
+    for(int spins = 0; atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos + i; spins++) {
+      spin_wait(spins);
+    }
+    cell->data = items[i];
+    atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_release); // publish the item
+  }
+
+  post_tokens(&queue->full, n);
+  *bin = pos % buffer_size;
+  return n;
+}
+
+int mpmc_get(int *items, int max_count, int *bin) {
+  int tokens = take_tokens(&queue->full, max_count); // items (or wake-up tokens from queue_close()) are available
+  if(tokens == 0) {
+    return 0;
+  }
+  int n;
+
+  // claim the next positions, once the producers are done never claim past the last one they filled
+  unsigned long pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  do {
+    n = tokens;
+    if(atomic_load(&queue->producer_done) && atomic_load(&queue->enqueue_pos) - pos < (unsigned long)n) {
+      n = atomic_load(&queue->enqueue_pos) - pos;
+    }
+  } while(n > 0 && !atomic_compare_exchange_weak(&queue->dequeue_pos, &pos, pos + n));
+
+  for(int i=0; i<n; i++) {
+    mpmc_cell *cell = &cells[(pos + i) % buffer_size];
+
+    // the producer that claimed this position may still be writing it, wait for it to publish
+    for(int spins = 0; atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos + i + 1; spins++) {
+      spin_wait(spins);
+    }
+    items[i] = cell->data;
+    atomic_store_explicit(&cell->sequence, pos + i + buffer_size, memory_order_release); // free the cell for the next lap
+  }
+
+  // return the wake-up tokens we can't use to the other consumers (they exit on them too once nothing is left)
+  post_tokens(&queue->full, tokens - n);
+  post_tokens(&queue->empty, n);
+  *bin = pos % buffer_size;
+  return n; // 0 means the producers are done and everything has been consumed
 }
\ No newline at end of file
@@ -1,158 +1,1151 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
 #include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// size of a cache line, used to keep indices written by different threads apart
+#define CACHE_LINE_SIZE 64
+// number of pause iterations a waiting thread spins before it yields or parks
+#define SPIN_LIMIT 1024
+// records a worker can queue before it has to wait for the log writer
+#define LOG_RING_SIZE 4096
+// size of the log writer's output buffer, flushed with a single write()
+#define LOG_FLUSH_SIZE 65536
+// records in the bytes engine start on this boundary so their headers stay aligned
+#define RECORD_ALIGN 8
+// header length marking the unused tail of the byte ring, the next record starts back at offset 0
+#define RECORD_WRAP UINT32_MAX
+// most filler bytes a producer appends to an item's record in bytes mode
+#define RECORD_MAX_FILL 63
+
+// the available buffer engines
+enum queue_mode {
+  MODE_MUTEX, // single mutex and two condition variables
+  MODE_SPSC,  // lock-free single-producer/single-consumer ring
+  MODE_MPMC,  // lock-free multi-producer/multi-consumer queue with sequence-numbered cells
+  MODE_BYTES  // lock-free single-producer/single-consumer ring of variable-length records
+};
+
+// how a producer or consumer waits for the other side
+enum wait_mode {
+  WAIT_SPIN,  // busy-spin with pause (for pinned cores and microsecond hand-offs)
+  WAIT_YIELD, // spin, then sched_yield between checks
+  WAIT_PARK   // spin, then sleep on the futex / condition variable until woken
+};
+
+// events a worker can log, formatted later by the log writer thread
+enum log_event {
+  LOG_PUT,
+  LOG_GET,
+  LOG_END_PRODUCER,
+  LOG_END_CONSUMER
+};
+
+struct log_record {
+  log_event event;
+  int item;
+  int bin;
+};
+
+// per-worker log buffer, only the owning worker appends and only the log writer drains
+struct log_ring {
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail; // next record the worker will write
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // next record the log writer will format
+  log_record records[LOG_RING_SIZE];
+};
+
+// paces one worker to a target rate with absolute deadlines, so time spent working or blocked doesn't add drift
+struct pacer {
+  double rate;          // items/sec the current schedule was built for (0 = unthrottled)
+  uint64_t deadline_ns; // when the next batch may start
+};
+
+// futex word that threads park on when a lock-free engine is empty or full
+struct wait_point {
+  alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> wake_seq; // futex word, bumped on every wake
+  std::atomic<uint32_t> sleepers; // number of threads parked (or about to park) on wake_seq
+};
+
+// lock-free single-producer/single-consumer ring state (slots live in buffer)
+struct spsc_ring {
+  // producer-owned cache line
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail; // next position the producer will write
+  uint64_t cached_head; // producer's last view of head (avoids reading the consumer's line each item)
+  // consumer-owned cache line
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // next position the consumer will read
+  uint64_t cached_tail; // consumer's last view of tail
+};
+
+// one slot of the mpmc queue, padded so neighbouring slots written by different threads don't false-share
+struct alignas(CACHE_LINE_SIZE) mpmc_cell {
+  std::atomic<uint64_t> sequence; // == position when free for that position's producer, position + 1 once filled
+  int data;
+};
+
+// bounded multi-producer/multi-consumer queue (Vyukov style), threads claim positions with a CAS
+struct mpmc_queue {
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> enqueue_pos; // next position a producer will claim
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> dequeue_pos; // next position a consumer will claim
+  alignas(CACHE_LINE_SIZE) mpmc_cell *cells;
+};
+
+// starts every record in the bytes engine, the payload follows it in place
+struct alignas(RECORD_ALIGN) record_header {
+  uint32_t length; // payload bytes, or RECORD_WRAP
+};
+
+// byte ring for the bytes engine, positions are free-running byte counts (offset = position % capacity)
+struct byte_ring {
+  // producer-owned cache line
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail; // position just past the last committed record
+  uint64_t cached_head;
+  uint64_t reserved;     // position of the header of the record being written
+  uint64_t reserved_end; // position just past it
+  // consumer-owned cache line
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // position of the next record to read
+  uint64_t cached_tail;
+  uint64_t peeked_end;   // position just past the record being read
+  alignas(CACHE_LINE_SIZE) uint8_t *bytes;
+  uint64_t capacity;     // a multiple of RECORD_ALIGN
+};
 
 void* producer(void *arg);
 void* consumer(void *arg);
+int queue_put(const int *items, int count, int *bin);
+int queue_get(int *items, int max_count, int *bin);
+void queue_close();
+int mutex_put(const int *items, int count, int *bin);
+int mutex_get(int *items, int max_count, int *bin);
+int spsc_put(const int *items, int count, int *bin);
+int spsc_get(int *items, int max_count, int *bin);
+int mpmc_put(const int *items, int count, int *bin);
+int mpmc_get(int *items, int max_count, int *bin);
+static inline uint64_t record_size(uint32_t length);
+uint8_t *record_reserve(uint32_t length, int *offset);
+void record_commit();
+const uint8_t *record_peek(uint32_t *length, int *offset);
+void record_release();
+int bytes_put(const int *items, int count, int *bin);
+int bytes_get(int *items, int max_count, int *bin);
+void wake(wait_point *wp, int count);
+void log_append(log_event event, int item, int bin);
+void* log_writer(void *arg);
+void apply_command(const std::string &command);
+void request_shutdown();
+void pace_wait(pacer *p, const std::atomic<double> *rate, const std::atomic<int> *sleep_time);
+void pace_charge(pacer *p, int items);
+double target_rate(double rate, int sleep_time);
+void* bench_producer(void *arg);
+void* bench_consumer(void *arg);
+void bench_report(double seconds);
 
 int buffer_size;
 int buffer_count;
 int *buffer;
-bool producer_done;
-std::string command_buffer;
-std::mutex mtx;
+int num_producers = 1, num_consumers = 1;
+int batch_size = 1; // most items moved per put/get
+long bench_items = 0; // items per producer in benchmark mode (0 runs the interactive program)
+uint64_t *bench_stamps; // enqueue time of each benchmark item, replaced by its latency once consumed
+std::atomic<int> producers_running;
+std::atomic<bool> producer_done;
+std::atomic<int> producer_sleep_time, consumer_sleep_time; // shared by all producers / all consumers
+std::atomic<double> producer_rate, consumer_rate; // items/sec per worker, negative to pace by sleep time instead
+std::atomic<bool> shutdown_requested; // set by q, producers stop and blocked puts give up
+std::atomic<uint32_t> control_seq; // futex word bumped on every command, so pacing sleeps re-read the knobs
+std::mutex mtx; // only guards the mutex engine's buffer
 std::condition_variable empty, full;
 int producer_index, consumer_index;
+queue_mode mode = MODE_MUTEX;
+wait_mode waiting = WAIT_PARK;
+int spin_limit = SPIN_LIMIT; // rounds spent spinning before yielding or parking
+spsc_ring ring;
+mpmc_queue mpmc;
+byte_ring message_ring;
+wait_point not_empty, not_full;
+int verbosity = 1; // 0 only logs when workers end, 1 also logs every item
+bool rate_mode = false; // the pacing arguments are items/sec rather than sleep ms
+std::vector<log_ring *> log_rings; // producers' rings first, then consumers'
+std::atomic<bool> log_stop; // set once every worker has exited, the log writer then drains and exits
+thread_local log_ring *thread_log; // the calling worker's log ring
 
 int main(int argc, char *argv[]) {
-  if(argc < 4) {
+  int opt;
+  while((opt = getopt(argc, argv, "m:p:c:k:B:v:rw:")) != -1) {
+    if(opt == 'm' && strcmp(optarg, "mutex") == 0) {
+      mode = MODE_MUTEX;
+    }
+    else if(opt == 'm' && strcmp(optarg, "spsc") == 0) {
+      mode = MODE_SPSC;
+    }
+    else if(opt == 'm' && strcmp(optarg, "mpmc") == 0) {
+      mode = MODE_MPMC;
+    }
+    else if(opt == 'm' && strcmp(optarg, "bytes") == 0) {
+      mode = MODE_BYTES;
+    }
+    else if(opt == 'p') {
+      num_producers = atoi(optarg);
+    }
+    else if(opt == 'c') {
+      num_consumers = atoi(optarg);
+    }
+    else if(opt == 'k') {
+      batch_size = atoi(optarg);
+    }
+    else if(opt == 'B') {
+      bench_items = atol(optarg);
+    }
+    else if(opt == 'v') {
+      verbosity = atoi(optarg);
+    }
+    else if(opt == 'r') {
+      rate_mode = true;
+    }
+    else if(opt == 'w' && strcmp(optarg, "spin") == 0) {
+      waiting = WAIT_SPIN;
+    }
+    else if(opt == 'w' && strcmp(optarg, "yield") == 0) {
+      waiting = WAIT_YIELD;
+    }
+    else if(opt == 'w' && strcmp(optarg, "park") == 0) {
+      waiting = WAIT_PARK;
+    }
+    else {
+      std::cerr << "Usage: " << argv[0] << " [-m mutex|spsc|mpmc|bytes] [-p producers] [-c consumers] [-k batch_size] [-B items] [-v verbosity] [-r] [-w spin|yield|park] buffer_size [producer_sleep consumer_sleep]" << std::endl;
+      std::cerr << "  -r takes the producer/consumer pacing as target items/sec per worker instead of sleep ms" << std::endl;
+      std::cerr << "  -w picks how blocked workers wait: busy-spin, spin then yield, or spin then sleep (default)" << std::endl;
+      std::cerr << "  -m bytes carries each item as a variable-length record, buffer_size is then in bytes" << std::endl;
+      exit(1);
+    }
+  }
+  if(argc - optind < (bench_items > 0 ? 1 : 3)) {
     std::cerr << "Err: must specify buffer size, producer sleep time, and consumer sleep time" << std::endl;
     exit(1);
   }
-  buffer_size = atoi(argv[1]); // desired size of the buffer
-  int producer_sleep_time = atoi(argv[2]); // desired sleep time for the producer
-  int consumer_sleep_time = atoi(argv[3]); // desired sleep time for the consumer
+  if(num_producers < 1 || num_consumers < 1) {
+    std::cerr << "Err: must have at least one producer and one consumer" << std::endl;
+    exit(1);
+  }
+  if(batch_size < 1) {
+    std::cerr << "Err: batch size must be at least one" << std::endl;
+    exit(1);
+  }
+  if(bench_items < 0 || bench_items * num_producers > INT_MAX) {
+    std::cerr << "Err: benchmark item count must be positive and fit every item id in an int" << std::endl;
+    exit(1);
+  }
+  if((mode == MODE_SPSC || mode == MODE_BYTES) && (num_producers != 1 || num_consumers != 1)) {
+    std::cerr << "Err: spsc and bytes modes support exactly one producer and one consumer" << std::endl;
+    exit(1);
+  }
+  if(std::thread::hardware_concurrency() == 1) {
+    spin_limit = 0; // the other side can't run while we spin on a single cpu, so yield or park straight away
+  }
+  buffer_size = atoi(argv[optind]); // desired size of the buffer
+  // a record that doesn't fit before the end of the byte ring needs the skipped bytes free as well as its own,
+  // which is only ever possible if the ring holds two of the largest record
+  if(mode == MODE_BYTES && buffer_size < (int)(2 * record_size(sizeof(int) + RECORD_MAX_FILL))) {
+    std::cerr << "Err: bytes mode needs a buffer of at least twice the largest record (" <<
+      2 * record_size(sizeof(int) + RECORD_MAX_FILL) << " bytes)" << std::endl;
+    exit(1);
+  }
+  // a filled cell's sequence (pos + 1) is also the free sequence of the next position, with one cell they are the same
+  // cell and a producer could overwrite an item no consumer has read yet
+  if(mode == MODE_MPMC && buffer_size < 2) {
+    std::cerr << "Err: mpmc mode needs a buffer of at least 2 items" << std::endl;
+    exit(1);
+  }
+  producer_rate = -1;
+  consumer_rate = -1;
+  if(bench_items == 0 && rate_mode) {
+    producer_rate = atof(argv[optind + 1]); // desired items/sec for each producer
+    consumer_rate = atof(argv[optind + 2]); // desired items/sec for each consumer
+  }
+  else if(bench_items == 0) {
+    producer_sleep_time = atoi(argv[optind + 1]); // desired sleep time for the producers
+    consumer_sleep_time = atoi(argv[optind + 2]); // desired sleep time for the consumers
+  }
 
-  // initialize the buffer and buffer size
-  buffer = new int[buffer_size];
+  // initialize the buffer and buffer size, only the storage of the selected engine is allocated (the others stay
+  // null, which delete[] ignores)
+  if(mode == MODE_MUTEX || mode == MODE_SPSC) {
+    buffer = new int[buffer_size];
+  }
   buffer_count = 0;
 
   // initialize the procucer and consumer index
   producer_index = 0;
   consumer_index = 0;
 
+  // initialize the spsc ring (only used in spsc mode)
+  ring.head = 0;
+  ring.tail = 0;
+  ring.cached_head = 0;
+  ring.cached_tail = 0;
+
+  // initialize the mpmc queue (only used in mpmc mode), cell i starts out free for position i
+  mpmc.enqueue_pos = 0;
+  mpmc.dequeue_pos = 0;
+  if(mode == MODE_MPMC) {
+    mpmc.cells = new mpmc_cell[buffer_size];
+    for(int i=0; i<buffer_size; i++) {
+      mpmc.cells[i].sequence = i;
+    }
+  }
+
+  // initialize the byte ring (only used in bytes mode)
+  message_ring.head = 0;
+  message_ring.tail = 0;
+  message_ring.cached_head = 0;
+  message_ring.cached_tail = 0;
+  message_ring.capacity = buffer_size / RECORD_ALIGN * RECORD_ALIGN;
+  if(mode == MODE_BYTES) {
+    message_ring.bytes = new uint8_t[message_ring.capacity];
+  }
+
+  // initialize the wait points used by the lock-free engines
+  not_empty.wake_seq = 0;
+  not_empty.sleepers = 0;
+  not_full.wake_seq = 0;
+  not_full.sleepers = 0;
+
   // initialize producer done boolean
   producer_done = false;
-  
-  std::thread producer_thread(producer, &producer_sleep_time); // create the producer thread
-  std::thread consumer_thread(consumer, &consumer_sleep_time); // create the consumer thread
+  producers_running = num_producers;
+
+  // benchmark mode runs a fixed workload with no sleeps, no printing and no command loop
+  if(bench_items > 0) {
+    bench_stamps = new uint64_t[bench_items * num_producers];
+    std::vector<int> producer_ids(num_producers);
+    std::vector<std::thread> producer_threads, consumer_threads;
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<num_producers; i++) {
+      producer_ids[i] = i;
+      producer_threads.emplace_back(bench_producer, &producer_ids[i]);
+    }
+    for(int i=0; i<num_consumers; i++) {
+      consumer_threads.emplace_back(bench_consumer, nullptr);
+    }
+    for(std::thread &t : producer_threads) {
+      t.join();
+    }
+    for(std::thread &t : consumer_threads) {
+      t.join();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    bench_report((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    delete[] bench_stamps;
+    delete[] buffer;
+    delete[] mpmc.cells;
+    delete[] message_ring.bytes;
+    return 0;
+  }
+
+  // give every worker its own log ring and start the thread that writes them out
+  for(int i=0; i<num_producers + num_consumers; i++) {
+    log_rings.push_back(new log_ring());
+  }
+  log_stop = false;
+  std::thread log_thread(log_writer, nullptr);
+
+  // create the producer and consumer threads (each is passed its worker number)
+  std::vector<int> producer_ids(num_producers), consumer_ids(num_consumers);
+  std::vector<std::thread> producer_threads, consumer_threads;
+  for(int i=0; i<num_producers; i++) {
+    producer_ids[i] = i;
+    producer_threads.emplace_back(producer, &producer_ids[i]);
+  }
+  for(int i=0; i<num_consumers; i++) {
+    consumer_ids[i] = i;
+    consumer_threads.emplace_back(consumer, &consumer_ids[i]);
+  }
 
   std::string user_input;
   // core loop to recieve user commands
   while(true) {
     // printf("Enter desired command: ");
-    std::cin >> user_input;
+    if(!(std::cin >> user_input)) {
+      user_input = "q"; // treat end of input as quit
+    }
 
     if(user_input == "q") {
       std::cout << "Preparing to quit" << std::endl;
+      request_shutdown();
+      break;
     }
+    apply_command(user_input);
+  }
 
-    mtx.lock(); // lock the mutex
-
-    command_buffer = user_input;
-
-    mtx.unlock(); // unlock the mutex
-
-    if(user_input == "q") {
-      break; // can check user_input after of sem_post since not shared (as opposed to command_buffer)
-    }
+  // join the producer and consumer threads
+  for(std::thread &t : producer_threads) {
+    t.join();
+  }
+  for(std::thread &t : consumer_threads) {
+    t.join();
   }
 
-  producer_thread.join(); // join the producer thread
-  consumer_thread.join(); // join the consumer thread
+  // let the log writer drain what the workers left behind
+  log_stop = true;
+  log_thread.join();
+  for(log_ring *lr : log_rings) {
+    delete lr;
+  }
 
   delete[] buffer; // free the buffer
+  delete[] mpmc.cells; // free the mpmc cells
+  delete[] message_ring.bytes; // free the byte ring
 
   return 0;
 }
 
 void* producer(void *arg) {
   // need upper bound to be 8001 so that rand() % upper_bound generates from 0-8000, then add 1000 so final range is 1000-9000
-  int upper_bound = 8001; 
-  int sleep_time = *(int *)arg;
-  int next_produced;
+  int upper_bound = 8001;
+  int id = *(int *)arg;
+  int bin, placed;
+  std::vector<int> next_produced(batch_size);
+  pacer pace = {0, 0};
 
-  srand(time(NULL)); // seed the random number generator with the current time
+  thread_log = log_rings[id];
+
+  // each producer keeps its own seed (rand() serializes every thread on a hidden lock)
+  unsigned int seed = time(NULL) + id;
+
+  while (!shutdown_requested.load(std::memory_order_relaxed)) {
+    // produce a batch of items in next_produced
+    for(int i=0; i<batch_size; i++) {
+      next_produced[i] = (rand_r(&seed) % (upper_bound)) + 1000; // generate a random number between 1000 and 9000
+    }
+
+    // wait for this batch's deadline (cut short by q)
+    pace_wait(&pace, &producer_rate, &producer_sleep_time);
+    if(shutdown_requested.load(std::memory_order_relaxed)) {
+      break;
+    }
+    pace_charge(&pace, batch_size);
+
+    // add next_produced to the buffer, the engine may take fewer than asked if the buffer is nearly full
+    for(int done = 0; done < batch_size; done += placed) {
+      placed = queue_put(&next_produced[done], batch_size - done, &bin);
+      if(placed == 0) {
+        break; // q was entered while we waited for room, the rest of the batch is dropped
+      }
+
+      for(int i=0; i<placed; i++) {
+        log_append(LOG_PUT, next_produced[done + i], (bin + i) % buffer_size);
+      }
+    }
+  }
+  // the last producer out wakes the consumers so they can drain the buffer and exit
+  if(producers_running.fetch_sub(1) == 1) {
+    queue_close();
+  }
+  log_append(LOG_END_PRODUCER, 0, 0);
+  return 0;
+}
 
+void* consumer(void *arg) {
+  int bin, taken;
+  std::vector<int> next_consumed(batch_size);
+  pacer pace = {0, 0};
+  thread_log = log_rings[num_producers + *(int *)arg];
   while (true) {
-    // produce an item in next_produced
-    next_produced = (rand() % (upper_bound)) + 1000; // generate a random number between 1000 and 9000
+    // wait for this batch's deadline (once q is entered the buffer is drained unthrottled)
+    pace_wait(&pace, &consumer_rate, &consumer_sleep_time);
+
+    // remove up to a batch of items from buffer to next_consumed (none once the producers are done and the buffer is drained)
+    taken = queue_get(next_consumed.data(), batch_size, &bin);
+    if(taken == 0) {
+      break;
+    }
+    pace_charge(&pace, taken); // only pay for what we actually got
 
-    std::unique_lock<std::mutex> lock(mtx); // lock the mutex
-    full.wait(lock, [] {return buffer_count < buffer_size;});
+    // consume the items in next_consumed
+    for(int i=0; i<taken; i++) {
+      log_append(LOG_GET, next_consumed[i], (bin + i) % buffer_size);
+    }
+  }
+  log_append(LOG_END_CONSUMER, 0, 0);
+  return 0;
+}
 
-    if(command_buffer == "a") {
-      sleep_time += 250;
-      command_buffer.clear(); // clear the buffer
+void apply_command(const std::string &command) {
+  // apply a control command straight to the shared pacing knobs, workers pick them up with relaxed loads
+  if(command == "a" || command == "z") {
+    // a slows the producers down, z speeds them up: halve/double the rate, or sleep longer/less
+    if(producer_rate >= 0) {
+      producer_rate = command == "a" ? producer_rate / 2 : producer_rate * 2;
+    }
+    else {
+      producer_sleep_time += command == "a" ? 250 : -250;
     }
-    else if(command_buffer == "z") {
-      sleep_time -= 250;
-      command_buffer.clear(); // clear the buffer
+  }
+  else if(command == "s" || command == "x") {
+    // s slows the consumers down, x speeds them up
+    if(consumer_rate >= 0) {
+      consumer_rate = command == "s" ? consumer_rate / 2 : consumer_rate * 2;
+    }
+    else {
+      consumer_sleep_time += command == "s" ? 250 : -250;
+    }
+  }
+  else if(command.compare(0, 2, "p=") == 0) {
+    producer_rate = atof(command.c_str() + 2); // switch to an exact items/sec
+  }
+  else if(command.compare(0, 2, "c=") == 0) {
+    consumer_rate = atof(command.c_str() + 2);
+  }
+  else {
+    return; // unknown command, nothing changed
+  }
+  // wake every worker sleeping out a deadline so the new rate applies now rather than after the old sleep
+  control_seq.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&control_seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+void request_shutdown() {
+  // stop the producers and cancel any put blocked on a full buffer, the consumers then drain what is left
+  shutdown_requested.store(true, std::memory_order_seq_cst);
+  control_seq.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&control_seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  if(mode != MODE_MUTEX) {
+    wake(&not_full, INT_MAX);
+    return;
+  }
+  // taking the lock orders the store with a producer that is about to wait, so it can't miss the notify
+  mtx.lock();
+  mtx.unlock();
+  full.notify_all();
+}
+
+void log_append(log_event event, int item, int bin) {
+  // queue a record on the calling worker's log ring, the log writer formats and writes it later
+  if(verbosity < 1 && (event == LOG_PUT || event == LOG_GET)) {
+    return; // per-item logging is turned off
+  }
+  log_ring *lr = thread_log;
+  uint64_t tail = lr->tail.load(std::memory_order_relaxed);
+
+  // wait for the log writer if our ring is full (slowing down beats dropping lines)
+  while(tail - lr->head.load(std::memory_order_acquire) == LOG_RING_SIZE) {
+    std::this_thread::yield();
+  }
+  lr->records[tail % LOG_RING_SIZE] = {event, item, bin};
+  lr->tail.store(tail + 1, std::memory_order_release);
+}
+
+static void log_flush(const char *out, size_t used) {
+  // write the whole output buffer to stdout, retrying on partial writes
+  while(used > 0) {
+    ssize_t written = write(STDOUT_FILENO, out, used);
+    if(written < 0) {
+      return; // nowhere to report the error, drop the batch
     }
-    mtx.unlock();
+    out += written;
+    used -= written;
+  }
+}
 
-    usleep(sleep_time * 1000); // sleep for the desired time
+void* log_writer(void *arg) {
+  // drain every worker's ring into one large buffer and write it out in big batches
+  char *out = new char[LOG_FLUSH_SIZE];
+  size_t used = 0;
+  (void)arg;
 
-    mtx.lock();
-    // add next_produced to the buffer
-    buffer[producer_index] = next_produced;
-    buffer_count++;
+  while(true) {
+    bool stopping = log_stop.load(std::memory_order_acquire); // read before draining so the last pass sees every record
+    bool drained = false;
 
-    std::cout << "Put " << next_produced << " into bin " << producer_index << std::endl;
-    producer_index = (producer_index + 1) % buffer_size; // make indexing wrap around
+    for(log_ring *lr : log_rings) {
+      uint64_t head = lr->head.load(std::memory_order_relaxed);
+      uint64_t tail = lr->tail.load(std::memory_order_acquire);
+      for(; head != tail; head++) {
+        if(used > LOG_FLUSH_SIZE - 64) { // room for the longest record
+          log_flush(out, used);
+          used = 0;
+        }
+        log_record *rec = &lr->records[head % LOG_RING_SIZE];
+        if(rec->event == LOG_PUT) {
+          used += snprintf(out + used, 64, "Put %d into bin %d\n", rec->item, rec->bin);
+        }
+        else if(rec->event == LOG_GET) {
+          used += snprintf(out + used, 64, "\tGet %d from bin %d\n", rec->item, rec->bin);
+        }
+        else if(rec->event == LOG_END_PRODUCER) {
+          used += snprintf(out + used, 64, "End of producer\n");
+        }
+        else {
+          used += snprintf(out + used, 64, "\tEnd of consumer\n");
+        }
+        drained = true;
+      }
+      lr->head.store(head, std::memory_order_release); // hand the slots back to the worker
+    }
 
-    if(command_buffer == "q") {
-      producer_done = true;
-      mtx.unlock();
-      empty.notify_one();
-      break; // break if q is in the command buffer
+    if(!drained) {
+      // nothing new, so push out what we have rather than holding it back
+      log_flush(out, used);
+      used = 0;
+      if(stopping) {
+        break;
+      }
+      usleep(1000);
     }
-    mtx.unlock();
-    empty.notify_one();
   }
-  std::cout << "End of producer" << std::endl;
+  delete[] out;
   return 0;
 }
 
-void* consumer(void *arg) {
-  int next_consumed;
-  int sleep_time = *(int *)arg;
-  while (true) {
-    std::unique_lock<std::mutex> lock(mtx); // lock the mutex
-    empty.wait(lock, [] {return buffer_count > 0;});
+static inline uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+double target_rate(double rate, int sleep_time) {
+  // the items/sec a worker should run at, a sleep time is one batch per sleep_time ms
+  if(rate >= 0) {
+    return rate;
+  }
+  return sleep_time > 0 ? batch_size * 1000.0 / sleep_time : 0;
+}
+
+void pace_wait(pacer *p, const std::atomic<double> *rate, const std::atomic<int> *sleep_time) {
+  // sleep until the next deadline on the schedule for the role's rate (0 = unthrottled),
+  // a command wakes us early so the knobs are re-read, and q ends the wait for good
+  while(true) {
+    uint32_t seq = control_seq.load(std::memory_order_acquire); // before the knobs, so a later command moves it
+    if(shutdown_requested.load(std::memory_order_relaxed)) {
+      return;
+    }
+    double r = target_rate(rate->load(std::memory_order_relaxed), sleep_time->load(std::memory_order_relaxed));
+    if(r <= 0) {
+      p->rate = 0;
+      return;
+    }
+    uint64_t now = now_ns();
+    uint64_t burst_ns = batch_size * 1e9 / r; // the bucket holds one batch worth of credit
+    if(r != p->rate) {
+      // first batch or the rate was changed: start a fresh schedule from now
+      p->rate = r;
+      p->deadline_ns = now;
+    }
+    else if(p->deadline_ns + burst_ns < now) {
+      // we fell behind (blocked on the buffer), catch up by at most one batch rather than bursting
+      p->deadline_ns = now - burst_ns;
+    }
+    if(p->deadline_ns <= now) {
+      return;
+    }
+    // absolute CLOCK_MONOTONIC deadline (FUTEX_WAIT_BITSET takes one), so early wakeups never stretch the schedule
+    timespec ts = {(time_t)(p->deadline_ns / 1000000000), (long)(p->deadline_ns % 1000000000)};
+    if(syscall(SYS_futex, reinterpret_cast<uint32_t *>(&control_seq), FUTEX_WAIT_BITSET_PRIVATE, seq, &ts, NULL,
+        FUTEX_BITSET_MATCH_ANY) == -1 && errno == ETIMEDOUT) {
+      return;
+    }
+    // woken by a command (or a signal), go round and re-read the knobs
+  }
+}
 
-    if(command_buffer == "s") {
-      sleep_time += 250;
-      command_buffer.clear(); // clear the buffer
+void pace_charge(pacer *p, int items) {
+  // move the deadline on by the time items take at the current rate
+  if(p->rate > 0) {
+    p->deadline_ns += items * 1e9 / p->rate;
+  }
+}
+
+void* bench_producer(void *arg) {
+  // item values are ids into bench_stamps, so consumers can find when each item was enqueued
+  int id = *(int *)arg;
+  int first_item = id * bench_items;
+  int bin;
+  std::vector<int> items(batch_size);
+
+  for(long produced = 0; produced < bench_items; ) {
+    int count = std::min<long>(batch_size, bench_items - produced);
+    for(int i=0; i<count; i++) {
+      items[i] = first_item + produced + i;
     }
-    else if(command_buffer == "x") {
-      sleep_time -= 250;
-      command_buffer.clear(); // clear the buffer
+    uint64_t now = now_ns();
+    for(int i=0; i<count; i++) {
+      bench_stamps[items[i]] = now;
     }
-    mtx.unlock();
+    for(int done = 0; done < count; ) {
+      done += queue_put(&items[done], count - done, &bin);
+    }
+    produced += count;
+  }
+  if(producers_running.fetch_sub(1) == 1) {
+    queue_close();
+  }
+  return 0;
+}
 
-    usleep(sleep_time * 1000); // sleep for the desired time
+void* bench_consumer(void *arg) {
+  int bin, taken;
+  std::vector<int> items(batch_size);
+  (void)arg;
 
-    mtx.lock();
-    // remove an item from buffer to next_consumed
-    next_consumed = buffer[consumer_index];
-    buffer_count--;
+  while((taken = queue_get(items.data(), batch_size, &bin)) > 0) {
+    uint64_t now = now_ns();
+    for(int i=0; i<taken; i++) {
+      bench_stamps[items[i]] = now - bench_stamps[items[i]]; // the queue hand-off orders this after the producer's stamp
+    }
+  }
+  return 0;
+}
 
-    // consume the item in next_consumed
-    std::cout << "\tGet " << next_consumed << " from bin " << consumer_index << std::endl;
-    consumer_index = (consumer_index + 1) % buffer_size; // make indexing wrap around
+void bench_report(double seconds) {
+  // print one machine-readable csv row:
+  // impl,mode,wait,buffer_size,producers,consumers,batch,items,seconds,items_per_sec,p50_ns,p99_ns,p999_ns
+  static const char *mode_names[] = {"mutex", "spsc", "mpmc", "bytes"};
+  static const char *wait_names[] = {"spin", "yield", "park"};
+  long total = bench_items * num_producers;
 
-    if(command_buffer == "q" && consumer_index == producer_index  && producer_done == true) {
-      mtx.unlock();
-      full.notify_one();
-      break; // break if q is in the command_buffer
+  std::sort(bench_stamps, bench_stamps + total);
+  printf("cpp,%s,%s,%d,%d,%d,%d,%ld,%.6f,%.0f,%llu,%llu,%llu\n", mode_names[mode], wait_names[waiting], buffer_size, num_producers,
+    num_consumers, batch_size, total, seconds, total / seconds,
+    (unsigned long long)bench_stamps[(long)((total - 1) * 0.5)],
+    (unsigned long long)bench_stamps[(long)((total - 1) * 0.99)],
+    (unsigned long long)bench_stamps[(long)((total - 1) * 0.999)]);
+}
+
+int queue_put(const int *items, int count, int *bin) {
+  // add up to count items to the buffer using the selected engine in one critical section,
+  // returns how many were added (at least one, or 0 if q cancelled a wait for room) and the bin the first one was placed in
+  if(mode == MODE_SPSC) {
+    return spsc_put(items, count, bin);
+  }
+  if(mode == MODE_MPMC) {
+    return mpmc_put(items, count, bin);
+  }
+  if(mode == MODE_BYTES) {
+    return bytes_put(items, count, bin);
+  }
+  return mutex_put(items, count, bin);
+}
+
+int queue_get(int *items, int max_count, int *bin) {
+  // remove up to max_count items from the buffer using the selected engine in one critical section,
+  // returns how many were removed and the bin of the first one (0 once the producers are done and the buffer is empty)
+  if(mode == MODE_SPSC) {
+    return spsc_get(items, max_count, bin);
+  }
+  if(mode == MODE_MPMC) {
+    return mpmc_get(items, max_count, bin);
+  }
+  if(mode == MODE_BYTES) {
+    return bytes_get(items, max_count, bin);
+  }
+  return mutex_get(items, max_count, bin);
+}
+
+void queue_close() {
+  // mark the producers as done and wake every consumer that may be waiting on an empty buffer
+  if(mode != MODE_MUTEX) {
+    producer_done.store(true, std::memory_order_seq_cst);
+    wake(&not_empty, INT_MAX);
+    return;
+  }
+  mtx.lock();
+  producer_done = true;
+  mtx.unlock();
+  empty.notify_all();
+}
+
+static inline void cpu_relax() {
+  // tell the cpu we are in a spin loop (saves power and frees the sibling hyperthread)
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+template<typename Predicate>
+static void park(wait_point *wp, Predicate still_blocked) {
+  // announce ourselves as a sleeper before re-checking, so a concurrent wake() either sees us or we see its update
+  uint32_t seq = wp->wake_seq.load(std::memory_order_acquire);
+  wp->sleepers.fetch_add(1, std::memory_order_seq_cst);
+  if(still_blocked()) {
+    // returns immediately if wake_seq already moved past seq
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&wp->wake_seq), FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+  }
+  wp->sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static inline void spin_wait(int spins) {
+  // one round of busy waiting: pause for the first spin_limit rounds (every round with -w spin), then yield the cpu
+  if(waiting == WAIT_SPIN || spins < spin_limit) {
+    cpu_relax();
+  }
+  else {
+    std::this_thread::yield();
+  }
+}
+
+template<typename Predicate>
+static void backoff(int spins, wait_point *wp, Predicate still_blocked) {
+  // one round of waiting for the other side of a lock-free engine, parking on the futex only with -w park
+  if(waiting == WAIT_PARK && spins >= spin_limit) {
+    park(wp, still_blocked);
+  }
+  else {
+    spin_wait(spins);
+  }
+}
+
+template<typename Predicate>
+static void mutex_wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, Predicate ready) {
+  // the mutex engine's version of backoff(), spinning drops the lock each round so the other side can get in
+  for(int spins = 0; !ready(); spins++) {
+    if(waiting == WAIT_PARK && spins >= spin_limit) {
+      cv.wait(lock, ready);
+      return;
     }
-    mtx.unlock();
+    lock.unlock();
+    spin_wait(spins);
+    lock.lock();
+  }
+}
+
+int mutex_put(const int *items, int count, int *bin) {
+  std::unique_lock<std::mutex> lock(mtx); // lock the mutex
+  mutex_wait(lock, full, [] {return buffer_count < buffer_size || shutdown_requested;});
+  if(buffer_count == buffer_size) {
+    return 0; // q was entered while the buffer was full
+  }
+
+  int n = std::min(count, buffer_size - buffer_count);
+  *bin = producer_index;
+  for(int i=0; i<n; i++) {
+    buffer[producer_index] = items[i];
+    producer_index = (producer_index + 1) % buffer_size; // make indexing wrap around
+  }
+  buffer_count += n;
+
+  lock.unlock();
+  if(n > 1) {
+    empty.notify_all(); // several consumers may be able to make progress
+  }
+  else {
+    empty.notify_one();
+  }
+  return n;
+}
+
+int mutex_get(int *items, int max_count, int *bin) {
+  std::unique_lock<std::mutex> lock(mtx); // lock the mutex
+  mutex_wait(lock, empty, [] {return buffer_count > 0 || producer_done;});
+  if(buffer_count == 0) {
+    return 0; // producers are done and everything has been consumed
+  }
+
+  int n = std::min(max_count, buffer_count);
+  *bin = consumer_index;
+  for(int i=0; i<n; i++) {
+    items[i] = buffer[consumer_index];
+    consumer_index = (consumer_index + 1) % buffer_size; // make indexing wrap around
+  }
+  buffer_count -= n;
+
+  lock.unlock();
+  if(n > 1) {
+    full.notify_all(); // several producers may be able to make progress
+  }
+  else {
     full.notify_one();
   }
-  std::cout << "\tEnd of consumer" << std::endl;
-  return 0;
+  return n;
+}
+
+void wake(wait_point *wp, int count) {
+  // only pay for the futex syscall when someone is actually parked
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(wp->sleepers.load(std::memory_order_relaxed) > 0) {
+    wp->wake_seq.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&wp->wake_seq), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+  }
+}
+
+int spsc_put(const int *items, int count, int *bin) {
+  uint64_t capacity = buffer_size;
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed); // only the producer writes tail
+
+  // refresh our cached view of head if it doesn't show room for the whole batch
+  if(capacity - (tail - ring.cached_head) < (uint64_t)count) {
+    ring.cached_head = ring.head.load(std::memory_order_acquire);
+  }
+  // the ring is full, wait for the consumer
+  for(int spins = 0; tail - ring.cached_head == capacity; spins++) {
+    if(shutdown_requested.load(std::memory_order_relaxed)) {
+      return 0; // q was entered while the ring was full
+    }
+    backoff(spins, &not_full, [tail, capacity] {
+      return tail - ring.head.load(std::memory_order_seq_cst) == capacity && !shutdown_requested.load(std::memory_order_seq_cst);
+    });
+    ring.cached_head = ring.head.load(std::memory_order_acquire);
+  }
+
+  int n = std::min<uint64_t>(count, capacity - (tail - ring.cached_head));
+  for(int i=0; i<n; i++) {
+    buffer[(tail + i) % capacity] = items[i];
+  }
+  ring.tail.store(tail + n, std::memory_order_release); // publish the whole batch to the consumer
+  wake(&not_empty, 1);
+  *bin = tail % capacity;
+  return n;
+}
+
+int spsc_get(int *items, int max_count, int *bin) {
+  uint64_t capacity = buffer_size;
+  uint64_t head = ring.head.load(std::memory_order_relaxed); // only the consumer writes head
+
+  // refresh our cached view of tail if it doesn't show a whole batch
+  if(ring.cached_tail - head < (uint64_t)max_count) {
+    ring.cached_tail = ring.tail.load(std::memory_order_acquire);
+  }
+  // the ring is empty, wait for the producer
+  for(int spins = 0; head == ring.cached_tail; spins++) {
+    if(producer_done.load(std::memory_order_acquire)) {
+      // the producer publishes its final tail before setting producer_done
+      ring.cached_tail = ring.tail.load(std::memory_order_acquire);
+      if(head == ring.cached_tail) {
+        return 0; // producer is done and everything has been consumed
+      }
+      break;
+    }
+    backoff(spins, &not_empty, [head] {
+      return head == ring.tail.load(std::memory_order_seq_cst) && !producer_done.load(std::memory_order_seq_cst);
+    });
+    ring.cached_tail = ring.tail.load(std::memory_order_acquire);
+  }
+
+  int n = std::min<uint64_t>(max_count, ring.cached_tail - head);
+  for(int i=0; i<n; i++) {
+    items[i] = buffer[(head + i) % capacity];
+  }
+  ring.head.store(head + n, std::memory_order_release); // hand the whole batch of slots back to the producer
+  wake(&not_full, 1);
+  *bin = head % capacity;
+  return n;
+}
+
+int mpmc_put(const int *items, int count, int *bin) {
+  uint64_t capacity = buffer_size;
+  uint64_t pos = mpmc.enqueue_pos.load(std::memory_order_relaxed);
+  int n;
+
+  // claim a run of positions whose cells have been freed by the consumers of the previous lap
+  for(int spins = 0; ; spins++) {
+    mpmc_cell *cell = &mpmc.cells[pos % capacity];
+    uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+    if(seq == pos) {
+      // extend the run while the following cells are free for their positions too
+      n = 1;
+      while(n < count && mpmc.cells[(pos + n) % capacity].sequence.load(std::memory_order_acquire) == pos + n) {
+        n++;
+      }
+      if(mpmc.enqueue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+        break; // the positions are ours
+      }
+      continue; // another producer claimed them first, pos now holds the current enqueue position
+    }
+    if(seq < pos) {
+      // the cell still holds last lap's item, so the queue is full
+      if(shutdown_requested.load(std::memory_order_relaxed)) {
+        return 0; // q was entered while the queue was full
+      }
+      backoff(spins, &not_full, [cell, pos] {
+        return cell->sequence.load(std::memory_order_seq_cst) < pos && !shutdown_requested.load(std::memory_order_seq_cst);
+      });
+    }
+    pos = mpmc.enqueue_pos.load(std::memory_order_relaxed);
+  }
+
+  for(int i=0; i<n; i++) {
+    mpmc_cell *cell = &mpmc.cells[(pos + i) % capacity];
+    cell->data = items[i];
+    cell->sequence.store(pos + i + 1, std::memory_order_release); // publish the item to consumers
+  }
+  wake(&not_empty, n);
+  *bin = pos % capacity;
+  return n;
+}
+
+int mpmc_get(int *items, int max_count, int *bin) {
+  uint64_t capacity = buffer_size;
+  uint64_t pos = mpmc.dequeue_pos.load(std::memory_order_relaxed);
+  int n;
+
+  // claim a run of positions whose cells have been filled by their producers
+  for(int spins = 0; ; spins++) {
+    mpmc_cell *cell = &mpmc.cells[pos % capacity];
+    uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+    if(seq == pos + 1) {
+      // extend the run while the following cells are filled for their positions too
+      n = 1;
+      while(n < max_count && mpmc.cells[(pos + n) % capacity].sequence.load(std::memory_order_acquire) == pos + n + 1) {
+        n++;
+      }
+      if(mpmc.dequeue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+        break; // the positions are ours
+      }
+      continue; // another consumer claimed them first, pos now holds the current dequeue position
+    }
+    if(seq < pos + 1) {
+      // the cell has not been filled for this lap, so the queue is empty
+      if(producer_done.load(std::memory_order_acquire)) {
+        // every producer finished its puts before producer_done was set, so nothing more will arrive
+        if(pos == mpmc.enqueue_pos.load(std::memory_order_acquire)) {
+          return 0; // producers are done and everything has been consumed
+        }
+      }
+      else {
+        backoff(spins, &not_empty, [cell, pos] {
+          return cell->sequence.load(std::memory_order_seq_cst) < pos + 1 && !producer_done.load(std::memory_order_seq_cst);
+        });
+      }
+    }
+    pos = mpmc.dequeue_pos.load(std::memory_order_relaxed);
+  }
+
+  for(int i=0; i<n; i++) {
+    mpmc_cell *cell = &mpmc.cells[(pos + i) % capacity];
+    items[i] = cell->data;
+    cell->sequence.store(pos + i + capacity, std::memory_order_release); // free the cell for the next lap's producer
+  }
+  wake(&not_full, n);
+  *bin = pos % capacity;
+  return n;
+}
+
+static inline uint64_t record_size(uint32_t length) {
+  // bytes a record with length bytes of payload takes up in the ring, header and padding included
+  return (sizeof(record_header) + length + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+
+uint8_t *record_reserve(uint32_t length, int *offset) {
+  // wait for room for a record with length bytes of payload and return where to write it in place,
+  // nothing is visible to the consumer until record_commit() (nullptr if q cancelled the wait)
+  byte_ring *r = &message_ring;
+  uint64_t tail = r->tail.load(std::memory_order_relaxed); // only the producer writes tail
+  uint64_t start = tail;
+  uint64_t size = record_size(length);
+
+  // a record never straddles the end of the ring, skip the leftover bytes and start again at offset 0
+  if(tail % r->capacity + size > r->capacity) {
+    start = tail + (r->capacity - tail % r->capacity);
+  }
+  for(int spins = 0; start + size - r->cached_head > r->capacity; spins++) {
+    if(shutdown_requested.load(std::memory_order_relaxed)) {
+      return nullptr; // q was entered while the ring was full
+    }
+    backoff(spins, &not_full, [r, start, size] {
+      return start + size - r->head.load(std::memory_order_seq_cst) > r->capacity &&
+        !shutdown_requested.load(std::memory_order_seq_cst);
+    });
+    r->cached_head = r->head.load(std::memory_order_acquire);
+  }
+
+  if(start != tail) {
+    // the room is ours now, so the consumer can't be reading where the wrap marker goes
+    reinterpret_cast<record_header *>(r->bytes + tail % r->capacity)->length = RECORD_WRAP;
+  }
+  r->reserved = start;
+  r->reserved_end = start + size;
+  reinterpret_cast<record_header *>(r->bytes + start % r->capacity)->length = length;
+  *offset = start % r->capacity;
+  return r->bytes + start % r->capacity + sizeof(record_header);
+}
+
+void record_commit() {
+  // publish the reserved record (and any wrap marker in front of it) to the consumer
+  message_ring.tail.store(message_ring.reserved_end, std::memory_order_release);
+  wake(&not_empty, 1);
+}
+
+const uint8_t *record_peek(uint32_t *length, int *offset) {
+  // wait for the next record and return a view of its payload in the ring, valid until record_release()
+  // (nullptr once the producer is done and everything has been read)
+  byte_ring *r = &message_ring;
+  uint64_t head = r->head.load(std::memory_order_relaxed); // only the consumer writes head
+
+  for(int spins = 0; head == r->cached_tail; spins++) {
+    if(producer_done.load(std::memory_order_acquire)) {
+      // the producer publishes its final tail before setting producer_done
+      r->cached_tail = r->tail.load(std::memory_order_acquire);
+      if(head == r->cached_tail) {
+        return nullptr; // producer is done and everything has been consumed
+      }
+      break;
+    }
+    backoff(spins, &not_empty, [r, head] {
+      return head == r->tail.load(std::memory_order_seq_cst) && !producer_done.load(std::memory_order_seq_cst);
+    });
+    r->cached_tail = r->tail.load(std::memory_order_acquire);
+  }
+
+  record_header *header = reinterpret_cast<record_header *>(r->bytes + head % r->capacity);
+  if(header->length == RECORD_WRAP) {
+    // the producer committed the wrap marker together with the record after it, which starts at offset 0
+    head += r->capacity - head % r->capacity;
+    header = reinterpret_cast<record_header *>(r->bytes);
+  }
+  r->peeked_end = head + record_size(header->length);
+  *length = header->length;
+  *offset = head % r->capacity;
+  return reinterpret_cast<const uint8_t *>(header + 1);
+}
+
+void record_release() {
+  // hand the bytes of the record we were reading back to the producer
+  message_ring.head.store(message_ring.peeked_end, std::memory_order_release);
+  wake(&not_full, 1);
+}
+
+int bytes_put(const int *items, int count, int *bin) {
+  // carry one item as a record of its value followed by a variable amount of filler,
+  // bin is the record's byte offset in the ring so only one record is placed per call
+  int item = items[0];
+  uint32_t length = sizeof(int) + item % (RECORD_MAX_FILL + 1);
+  (void)count;
+
+  uint8_t *payload = record_reserve(length, bin);
+  if(payload == nullptr) {
+    return 0;
+  }
+  memcpy(payload, &item, sizeof(int));
+  memset(payload + sizeof(int), item & 0xff, length - sizeof(int));
+  record_commit();
+  return 1;
+}
+
+int bytes_get(int *items, int max_count, int *bin) {
+  // read the item back out of the next record without copying the rest of it
+  uint32_t length;
+  const uint8_t *payload = record_peek(&length, bin);
+  (void)max_count;
+
+  if(payload == nullptr) {
+    return 0;
+  }
+  memcpy(&items[0], payload, sizeof(int));
+  record_release();
+  return 1;
 }
\ No newline at end of file